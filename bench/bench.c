@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#include "../server/utils/buffer.h"
+#include "../server/utils/hmap.h"
+#include "../server/utils/random.h"
+#include "../server/utils/err.h"
+#include "../server/engine.h"
+#include "../server/msg.h"
+#include "../server/net.h"
+
+// Micro-benchmarks of the server's hot paths. Every result is printed as a single line
+// of JSON, so that outputs of two builds can be compared with a script.
+//
+// Usage: robots-bench [--quick]
+
+/** ******************************************************** */
+/**                   Allocation counting                    */
+/** ******************************************************** */
+
+// The bench is linked with `--wrap` for these functions, so every allocation made by
+// the engine and the message builders goes through here.
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+void *__wrap_malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    alloc_count++;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    __real_free(ptr);
+}
+
+/** ******************************************************** */
+/**                        Utilities                         */
+/** ******************************************************** */
+
+struct measurement {
+    uint64_t start_ns;
+    uint64_t start_allocs;
+    uint64_t start_bytes;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000000 + (uint64_t) spec.tv_nsec;
+}
+
+static struct measurement measure_start(void) {
+    struct measurement m = {now_ns(), alloc_count, alloc_bytes};
+    return m;
+}
+
+// Print the per-operation cost of `n_ops` operations measured since `m` was started,
+// preceded by `fields`, which are the bench's name and parameters as JSON members.
+static void measure_report(struct measurement m, uint64_t n_ops, const char *fields) {
+    uint64_t ns = now_ns() - m.start_ns;
+    printf("{%s, \"ops\": %" PRIu64 ", \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"bytes_per_op\": %.1f}\n",
+           fields, n_ops, (double) ns / (double) n_ops,
+           (double) (alloc_count - m.start_allocs) / (double) n_ops,
+           (double) (alloc_bytes - m.start_bytes) / (double) n_ops);
+    fflush(stdout);
+}
+
+// xorshift, so that the scenarios don't depend on the engine's RNG
+static uint64_t bench_rng = 88172645463325252u;
+
+static uint32_t bench_random(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return (uint32_t) bench_rng;
+}
+
+static void random_actions(struct msg_action *actions, uint8_t players_count) {
+    for (int id = 0; id < players_count; id++) {
+        uint32_t r = bench_random() % 10;
+        actions[id].type = r < 2 ? PLACE_BOMB : r < 3 ? PLACE_BLOCK : r < 9 ? MOVE : NONE;
+        actions[id].direction = (uint8_t) (bench_random() % 4);
+    }
+}
+
+// Reads and discards everything sent to `*fd`, so that sends to the other end never block.
+static void *drain_socket(void *fd) {
+    char buf[1 << 16];
+    while (recv(*(int *) fd, buf, sizeof buf, 0) > 0);
+    return NULL;
+}
+
+// Wait until everything queued on `sock` is written, like a worker does on `EPOLLOUT`,
+// so that the measurements include flushing, but the queue never overflows.
+static void flush_sock(struct client_sock *sock) {
+    while (sock->fd != -1 && sock_pending(sock) > 0) {
+        struct pollfd pfd = {.fd = sock->fd, .events = POLLOUT};
+        poll(&pfd, 1, -1);
+        sock_flush(sock);
+    }
+}
+
+/** ******************************************************** */
+/**                    Engine benchmarks                     */
+/** ******************************************************** */
+
+struct scenario {
+    uint16_t size;
+    uint8_t players_count;
+    uint32_t live_bombs;
+    uint16_t explosion_radius;
+    uint16_t blast_threads; // 0 for no thread pool
+    bool no_blocks;         // so that blasts reach as far as they can
+};
+
+// Replay the game `engine` played without a thread pool, and make sure that the pool
+// didn't change a single byte of any turn.
+static void ensure_same_turns(struct engine *engine, struct prog_args *args, struct msg_action *warmup_actions,
+                              uint16_t warmup_turns, struct msg_action *turn_actions, uint16_t n_turns) {
+    struct engine *serial = engine_new(args);
+    buffer_t *turns = engine->state->turn_bufs;
+    buffer_t *expected = engine_start(serial);
+    ENSURE(expected->size == turns[0].size && memcmp(expected->buf, turns[0].buf, expected->size) == 0);
+
+    for (uint16_t i = 0; i < warmup_turns + n_turns; i++) {
+        struct msg_action *actions = i < warmup_turns ? warmup_actions
+                                                      : turn_actions + (size_t) (i - warmup_turns) * args->players_count;
+        expected = engine_step(serial, actions);
+        buffer_t *got = &turns[i + 1];
+        ENSURE(expected->size == got->size && memcmp(expected->buf, got->buf, expected->size) == 0);
+    }
+
+    engine_free(serial);
+}
+
+static void bench_engine(struct scenario sc, uint16_t n_turns) {
+    struct prog_args args;
+    memset(&args, 0, sizeof args);
+
+    args.players_count = sc.players_count;
+    args.size_x = sc.size;
+    args.size_y = sc.size;
+    args.explosion_radius = sc.explosion_radius;
+    args.seed = 42;
+
+    uint32_t tiles = (uint32_t) sc.size * sc.size;
+    args.initial_blocks = (uint16_t) (tiles / 10 < UINT16_MAX ? tiles / 10 : UINT16_MAX);
+    if (sc.no_blocks)
+        args.initial_blocks = 0;
+
+    // To get `live_bombs` live bombs, every robot places a bomb each turn for as many turns
+    // as a bomb's timer, so that the first of these bombs explode when the measured turns start.
+    uint16_t warmup_turns = 0;
+    args.bomb_timer = 5;
+    if (sc.live_bombs > 0) {
+        warmup_turns = (uint16_t) ((sc.live_bombs + sc.players_count - 1) / sc.players_count);
+        args.bomb_timer = warmup_turns;
+    }
+    args.game_length = (uint16_t) (warmup_turns + n_turns);
+
+    struct engine *engine = engine_new(&args);
+    if (sc.blast_threads > 0)
+        engine->pool = thread_pool_new(sc.blast_threads);
+    engine_start(engine);
+
+    struct msg_action actions[MAX_CLIENT_COUNT];
+    memset(actions, 0, sizeof actions);
+    for (int id = 0; id < sc.players_count; id++)
+        actions[id].type = PLACE_BOMB;
+    for (uint16_t i = 0; i < warmup_turns; i++)
+        engine_step(engine, actions);
+
+    // pre-generate the actions, so that only the engine is measured
+    struct msg_action *turn_actions = malloc((size_t) n_turns * sc.players_count * sizeof *turn_actions);
+    ENSURE(turn_actions != NULL);
+    for (uint16_t i = 0; i < n_turns; i++)
+        random_actions(turn_actions + (size_t) i * sc.players_count, sc.players_count);
+
+    uint64_t bytes = 0;
+    struct measurement m = measure_start();
+    for (uint16_t i = 0; i < n_turns; i++)
+        bytes += engine_step(engine, turn_actions + (size_t) i * sc.players_count)->size;
+
+    char fields[256];
+    snprintf(fields, sizeof fields,
+             "\"bench\": \"analyze_turn\", \"size_x\": %u, \"size_y\": %u, \"players\": %u, "
+             "\"live_bombs\": %u, \"radius\": %u, \"blast_threads\": %u, \"turn_bytes\": %.1f",
+             sc.size, sc.size, sc.players_count, sc.live_bombs, sc.explosion_radius, sc.blast_threads,
+             (double) bytes / n_turns);
+    measure_report(m, n_turns, fields);
+
+    if (engine->pool)
+        ensure_same_turns(engine, &args, actions, warmup_turns, turn_actions, n_turns);
+
+    free(turn_actions);
+    if (engine->pool)
+        thread_pool_free(engine->pool);
+    engine_free(engine);
+}
+
+// Once a game was played, the engine's arenas and maps are big enough for the next
+// games like it, whose turns then mustn't call the allocator at all.
+static void bench_heap_calls(uint16_t game_length) {
+    struct prog_args args;
+    memset(&args, 0, sizeof args);
+
+    args.players_count = MAX_CLIENT_COUNT;
+    args.size_x = 100;
+    args.size_y = 100;
+    args.game_length = game_length;
+    args.explosion_radius = 5;
+    args.bomb_timer = 5;
+    args.initial_blocks = 1000;
+    args.seed = 42;
+
+    struct engine *engine = engine_new(&args);
+    struct msg_action *turn_actions = malloc((size_t) game_length * args.players_count * sizeof *turn_actions);
+    ENSURE(turn_actions != NULL);
+    for (uint16_t i = 0; i < game_length; i++)
+        random_actions(turn_actions + (size_t) i * args.players_count, args.players_count);
+
+    engine_start(engine);
+    engine_fast_forward(engine, turn_actions, game_length);
+
+    engine_start(engine);
+    struct measurement m = measure_start();
+    engine_fast_forward(engine, turn_actions, game_length);
+    ENSURE(alloc_count == m.start_allocs);
+    measure_report(m, game_length, "\"bench\": \"turn_heap_calls\"");
+
+    free(turn_actions);
+    engine_free(engine);
+}
+
+/** ******************************************************** */
+/**                     Utils benchmarks                     */
+/** ******************************************************** */
+
+static void bench_hmap(uint32_t n_keys) {
+    char fields[128];
+    int dummy;
+    hmap_t *map = hmap_new();
+
+    struct measurement m = measure_start();
+    for (uint32_t key = 0; key < n_keys; key++)
+        hmap_insert(map, key, &dummy);
+    snprintf(fields, sizeof fields, "\"bench\": \"hmap_insert\", \"keys\": %u", n_keys);
+    measure_report(m, n_keys, fields);
+
+    m = measure_start();
+    for (uint32_t key = 0; key < n_keys; key++)
+        ENSURE(hmap_get(map, key) == &dummy);
+    snprintf(fields, sizeof fields, "\"bench\": \"hmap_get\", \"keys\": %u", n_keys);
+    measure_report(m, n_keys, fields);
+
+    uint32_t key;
+    void *value;
+    uint64_t n_seen = 0;
+    m = measure_start();
+    hmap_it_t it = hmap_iterator(map);
+    while (hmap_next(map, &it, &key, &value))
+        n_seen++;
+    ENSURE(n_seen == n_keys);
+    snprintf(fields, sizeof fields, "\"bench\": \"hmap_next\", \"keys\": %u", n_keys);
+    measure_report(m, n_keys, fields);
+
+    // every other key is removed while iterating, which mustn't make the iterator skip any
+    n_seen = 0;
+    m = measure_start();
+    it = hmap_iterator(map);
+    while (hmap_next(map, &it, &key, &value)) {
+        if (key % 2 == 0)
+            hmap_remove(map, key, false);
+        n_seen++;
+    }
+    ENSURE(n_seen == n_keys);
+    snprintf(fields, sizeof fields, "\"bench\": \"hmap_remove_iterating\", \"keys\": %u", n_keys);
+    measure_report(m, n_keys, fields);
+
+    m = measure_start();
+    for (key = 1; key < n_keys; key += 2)
+        hmap_remove(map, key, false);
+    snprintf(fields, sizeof fields, "\"bench\": \"hmap_remove\", \"keys\": %u", n_keys / 2);
+    measure_report(m, n_keys / 2, fields);
+
+    hmap_free(map, false);
+}
+
+static void bench_buffer(size_t push_size, uint32_t n_pushes) {
+    char fields[128];
+    char data[64];
+    memset(data, 0, sizeof data);
+
+    struct measurement m = measure_start();
+    buffer_t *buffer = buffer_new();
+    for (uint32_t i = 0; i < n_pushes; i++)
+        buffer_push(buffer, data, push_size);
+    buffer_free(buffer);
+
+    snprintf(fields, sizeof fields, "\"bench\": \"buffer_push\", \"push_size\": %zu, \"pushes\": %u",
+             push_size, n_pushes);
+    measure_report(m, n_pushes, fields);
+}
+
+// Short-lived buffers holding a few typed fields each, like most messages are.
+static void bench_small_buffers(uint32_t n_buffers) {
+    char fields[128];
+
+    struct measurement m = measure_start();
+    for (uint32_t i = 0; i < n_buffers; i++) {
+        buffer_t *buffer = buffer_new();
+        buffer_push_u8(buffer, 3);
+        buffer_push_u16(buffer, (uint16_t) i);
+        buffer_push_u32(buffer, i);
+        buffer_push_pos(buffer, 1, 2);
+        buffer_free(buffer);
+    }
+
+    snprintf(fields, sizeof fields, "\"bench\": \"small_buffers\", \"fields\": 4");
+    measure_report(m, n_buffers, fields);
+}
+
+static const char *random_kind_names[] = {"lcg", "xoshiro"};
+
+// Positions drawn one coordinate at a time, or a batch at a time.
+static void bench_rng_positions(enum random_kind kind, bool batched, uint32_t n_positions) {
+    char fields[128];
+    uint16_t coords[2 * 256];
+    uint32_t sink = 0;
+    random_t rng;
+    random_start(&rng, kind, 42);
+
+    struct measurement m = measure_start();
+    for (uint32_t done = 0; done < n_positions; done += 256) {
+        if (batched) {
+            random_pos_fill(&rng, coords, 256, 1000, 1000);
+        } else {
+            for (int i = 0; i < 256; i++) {
+                coords[2 * i] = random_pos_next(&rng, 1000);
+                coords[2 * i + 1] = random_pos_next(&rng, 1000);
+            }
+        }
+        sink += coords[0] + coords[511];
+    }
+
+    snprintf(fields, sizeof fields, "\"bench\": \"random_pos\", \"rng\": \"%s\", \"batched\": %s, \"sink\": %u",
+             random_kind_names[kind], batched ? "true" : "false", sink);
+    measure_report(m, n_positions, fields);
+}
+
+/** ******************************************************** */
+/**                   Messages benchmarks                    */
+/** ******************************************************** */
+
+#define BENCH_VIEWERS 16
+
+// A connected client socket, whose other end is read by a thread of its own.
+struct bench_peer {
+    int fds[2];
+    pthread_t drainer;
+    struct client_sock sock;
+};
+
+static void peer_open(struct bench_peer *peer) {
+    CHECK_ERRNO(socketpair(AF_UNIX, SOCK_STREAM, 0, peer->fds));
+    CHECK(pthread_create(&peer->drainer, NULL, drain_socket, &peer->fds[1]));
+    sock_init(&peer->sock, peer->fds[0]);
+}
+
+static void peer_close(struct bench_peer *peer) {
+    sock_free(&peer->sock);
+    CHECK(pthread_join(peer->drainer, NULL));
+    close(peer->fds[1]);
+}
+
+// Encode the frame returned by `encode`, send it and release it.
+#define SEND_ONCE(sock, encode) do {            \
+        struct frame *frame_ = (encode);        \
+        sock_send((sock), frame_);              \
+        frame_unref(frame_);                    \
+        flush_sock(sock);                       \
+    } while (0)
+
+static void bench_messages(uint32_t n_ops) {
+    char fields[128];
+
+    struct bench_peer peers[BENCH_VIEWERS];
+    for (int i = 0; i < BENCH_VIEWERS; i++)
+        peer_open(&peers[i]);
+    struct client_sock *sock = &peers[0].sock;
+
+    // a lobby full of players, as the server would see it
+    char name[] = "\x0c" "bench-server";
+    char player_name[] = "\x06" "player";
+    char address[] = "\x0e" "[::1]:12345678";
+
+    struct prog_args args;
+    memset(&args, 0, sizeof args);
+    args.server_name = name;
+    args.players_count = MAX_CLIENT_COUNT;
+
+    struct msg_player players[MAX_CLIENT_COUNT];
+    memset(players, 0, sizeof players);
+    for (int id = 0; id < MAX_CLIENT_COUNT; id++) {
+        players[id].id = (player_id_t) id;
+        players[id].name = player_name;
+        players[id].address = address;
+    }
+
+    score_t scores[MAX_CLIENT_COUNT];
+    memset(scores, 0, sizeof scores);
+
+    buffer_t *hello_buf = buffer_new();
+    struct measurement m = measure_start();
+    for (uint32_t i = 0; i < n_ops; i++) {
+        buffer_clear(hello_buf);
+        serialize_hello(hello_buf, build_hello(args));
+    }
+    measure_report(m, n_ops, "\"bench\": \"serialize_hello\"");
+
+    m = measure_start();
+    for (uint32_t i = 0; i < n_ops; i++)
+        frame_unref(encode_game_ended(scores, MAX_CLIENT_COUNT));
+    measure_report(m, n_ops, "\"bench\": \"encode_game_ended\"");
+
+    m = measure_start();
+    for (uint32_t i = 0; i < n_ops; i++)
+        SEND_ONCE(sock, encode_hello(hello_buf));
+    measure_report(m, n_ops, "\"bench\": \"send_hello\"");
+
+    m = measure_start();
+    for (uint32_t i = 0; i < n_ops; i++)
+        SEND_ONCE(sock, encode_accepted_player(&players[0]));
+    measure_report(m, n_ops, "\"bench\": \"send_accepted_player\"");
+
+    m = measure_start();
+    for (uint32_t i = 0; i < n_ops; i++)
+        SEND_ONCE(sock, encode_game_started(players, MAX_CLIENT_COUNT));
+    measure_report(m, n_ops, "\"bench\": \"send_game_started\"");
+
+    // `Turn` messages of a few typical sizes
+    size_t turn_sizes[] = {4, 256, 4096};
+    for (size_t k = 0; k < sizeof turn_sizes / sizeof *turn_sizes; k++) {
+        buffer_t *turn_buf = buffer_new();
+        char zeros[4096];
+        memset(zeros, 0, sizeof zeros);
+        buffer_push(turn_buf, zeros, turn_sizes[k]);
+
+        m = measure_start();
+        for (uint32_t i = 0; i < n_ops; i++)
+            SEND_ONCE(sock, encode_turn(turn_buf, (uint16_t) i));
+        snprintf(fields, sizeof fields, "\"bench\": \"send_turn\", \"turn_bytes\": %zu", turn_sizes[k]);
+        measure_report(m, n_ops, fields);
+
+        // the same turn to a whole audience, as a room broadcasts it
+        m = measure_start();
+        for (uint32_t i = 0; i < n_ops; i++) {
+            struct frame *frame = encode_turn(turn_buf, (uint16_t) i);
+            for (int p = 0; p < BENCH_VIEWERS; p++)
+                sock_send(&peers[p].sock, frame);
+            frame_unref(frame);
+            for (int p = 0; p < BENCH_VIEWERS; p++)
+                flush_sock(&peers[p].sock);
+        }
+        snprintf(fields, sizeof fields, "\"bench\": \"broadcast_turn\", \"turn_bytes\": %zu, \"viewers\": %d",
+                 turn_sizes[k], BENCH_VIEWERS);
+        measure_report(m, n_ops, fields);
+
+        buffer_free(turn_buf);
+    }
+
+    // a batch of input as a single read returns it: moves, each followed by a bomb
+    char input[4096];
+    for (size_t i = 0; i + 3 <= sizeof input; i += 3) {
+        input[i] = MOVE;
+        input[i + 1] = (char) (i % 4);
+        input[i + 2] = PLACE_BOMB;
+    }
+    size_t input_len = sizeof input / 3 * 3;
+
+    struct msg_parser parser;
+    parser_init(&parser);
+    uint64_t n_parsed = 0;
+    m = measure_start();
+    for (uint32_t i = 0; i < n_ops / 100; i++) {
+        size_t pos = 0;
+        while (pos < input_len) {
+            size_t consumed;
+            if (parse_message(&parser, input + pos, input_len - pos, &consumed) == PARSE_DONE)
+                n_parsed++;
+            pos += consumed;
+        }
+    }
+    measure_report(m, n_parsed, "\"bench\": \"parse_actions\"");
+
+    buffer_free(hello_buf);
+    for (int i = 0; i < BENCH_VIEWERS; i++)
+        peer_close(&peers[i]);
+}
+
+int main(int argc, char **argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+
+    uint16_t sizes[] = {10, 100, 1024, 8192};
+    struct scenario scenarios[] = {
+        {0, 2,  0,      5, 0, false},
+        {0, 2,  1000,   5, 0, false},
+        {0, 25, 0,      5, 0, false},
+        {0, 25, 1000,   5, 0, false},
+        {0, 25, 100000, 5, 0, false},
+    };
+
+    // explosions reaching across the whole board, worked out with and without helper threads;
+    // the pool only helps once the rays to scan add up to `PARALLEL_MIN_REACH` (2^18 tiles),
+    // i.e. with a radius of 12287 once at least 22 bombs explode in a turn, which they do
+    // in each of the first 200 measured turns, as 25 robots placed 5000 bombs beforehand
+    struct scenario long_blasts[] = {
+        {12288, 25, 5000, 12287, 0, true},
+        {12288, 25, 5000, 12287, 3, true},
+        {16384, 25, 5000, 16383, 0, true},
+        {16384, 25, 5000, 16383, 3, true},
+    };
+
+    for (size_t i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+        for (size_t j = 0; j < sizeof scenarios / sizeof *scenarios; j++) {
+            struct scenario sc = scenarios[j];
+            sc.size = sizes[i];
+            if (quick && (sc.size > 1024 || sc.live_bombs > 1000))
+                continue;
+            bench_engine(sc, quick ? 200 : 2000);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof long_blasts / sizeof *long_blasts; i++) {
+        if (quick && long_blasts[i].size > 12288)
+            continue;
+        bench_engine(long_blasts[i], quick ? 200 : 2000);
+    }
+
+    bench_heap_calls(1000);
+
+    bench_hmap(100);
+    bench_hmap(quick ? 1000 : 10000);
+
+    bench_buffer(3, 1000000);
+    bench_buffer(64, 100000);
+    bench_small_buffers(quick ? 100000 : 1000000);
+
+    for (int kind = RANDOM_LCG; kind <= RANDOM_XOSHIRO; kind++) {
+        bench_rng_positions((enum random_kind) kind, false, quick ? 1000000 : 10000000);
+        bench_rng_positions((enum random_kind) kind, true, quick ? 1000000 : 10000000);
+    }
+
+    bench_messages(quick ? 10000 : 100000);
+
+    return 0;
+}
@@ -6,6 +6,8 @@
 
 #include "utils/err.h"
 
+#define BOMBS_PER_SLAB 256
+
 struct game_state *init_state(struct msg_hello *hello) {
     struct game_state *state = malloc(sizeof *state);
     ENSURE(state != NULL);
@@ -25,6 +27,7 @@ struct game_state *init_state(struct msg_hello *hello) {
     }
 
     state->bombs = hmap_new();
+    state->bombs_pool = pool_new(sizeof(struct bomb_state), BOMBS_PER_SLAB);
 
     memset(state->scores, 0, sizeof state->scores);
 
@@ -39,8 +42,8 @@ void reset_state(struct game_state *state, struct msg_hello *hello) {
             state->blocked[i][j] = false;
     }
 
-    hmap_free(state->bombs, true);
-    state->bombs = hmap_new();
+    hmap_clear(state->bombs, false);
+    pool_clear(state->bombs_pool);
 
     memset(state->scores, 0, sizeof state->scores);
 }
@@ -49,7 +52,8 @@ void free_state(struct game_state *state, uint16_t size_x) {
     for (int i = 0; i < size_x; i++)
         free(state->blocked[i]);
     free(state->blocked);
-    hmap_free(state->bombs, true);
+    hmap_free(state->bombs, false);
+    pool_free(state->bombs_pool);
     free(state);
 }
 
@@ -83,9 +87,7 @@ void analyze_turn(struct game_state *state, struct msg_turn *turn) {
                 bomb_id = events[i].event_data.bomb_placed.bomb_id;
                 pos = events[i].event_data.bomb_placed.pos;
 
-                struct bomb_state *bomb = malloc(sizeof *bomb);
-                ENSURE(bomb != NULL);
-
+                struct bomb_state *bomb = pool_alloc(state->bombs_pool);
                 bomb->pos = pos;
                 bomb->timer = state->bomb_timer;
                 bomb->exploded = false;
@@ -135,3 +137,43 @@ void analyze_turn(struct game_state *state, struct msg_turn *turn) {
     free(events);
     free(turn->event_list);
 }
+
+void remove_bomb(struct game_state *state, uint32_t bomb_id) {
+    struct bomb_state *bomb = hmap_get(state->bombs, bomb_id);
+    if (bomb) {
+        hmap_remove(state->bombs, bomb_id, false);
+        pool_release(state->bombs_pool, bomb);
+    }
+}
+
+void apply_snapshot(struct game_state *state, struct msg_snapshot *snapshot, struct msg_hello *hello) {
+    reset_state(state, hello);
+    state->turn = snapshot->turn;
+
+    memcpy(state->players, snapshot->players, sizeof state->players);
+    memcpy(state->scores, snapshot->scores, sizeof state->scores);
+
+    struct position *blocks = snapshot->blocks->arr;
+    for (size_t i = 0; i < snapshot->blocks->size; i++) {
+        uint16_t x = ntohs(blocks[i].x);
+        uint16_t y = ntohs(blocks[i].y);
+        if (x < hello->size_x && y < hello->size_y)
+            state->blocked[x][y] = true;
+    }
+
+    struct msg_bomb *bombs = snapshot->bombs->arr;
+    for (size_t i = 0; i < snapshot->bombs->size; i++) {
+        struct bomb_state *bomb = pool_alloc(state->bombs_pool);
+        bomb->pos = bombs[i].pos;
+        bomb->timer = ntohs(bombs[i].timer);
+        bomb->exploded = false;
+
+        // like in `analyze_turn()`, bombs are keyed by their ids in network byte order
+        hmap_insert(state->bombs, bombs[i].bomb_id, bomb);
+    }
+
+    free(snapshot->blocks->arr);
+    free(snapshot->blocks);
+    free(snapshot->bombs->arr);
+    free(snapshot->bombs);
+}
@@ -5,6 +5,7 @@
 
 #include "msg.h"
 #include "utils/hmap.h"
+#include "utils/pool.h"
 
 struct bomb_state {
     struct position pos;
@@ -17,7 +18,8 @@ struct game_state {
     score_t scores[MAX_CLIENT_COUNT];
     uint16_t turn;
     bool **blocked;
-    hmap_t *bombs;
+    hmap_t *bombs;      // bomb id, in network byte order -> bomb
+    pool_t *bombs_pool; // where the bombs in `bombs` live
     uint16_t explosion_radius;
     uint16_t bomb_timer;
 };
@@ -30,4 +32,10 @@ void reset_state(struct game_state *state, struct msg_hello *hello);
 
 void analyze_turn(struct game_state *state, struct msg_turn *turn);
 
+// Forget about the bomb `bomb_id`, given in network byte order.
+void remove_bomb(struct game_state *state, uint32_t bomb_id);
+
+// Replace the whole state by the one described by the snapshot, and free its lists.
+void apply_snapshot(struct game_state *state, struct msg_snapshot *snapshot, struct msg_hello *hello);
+
 #endif
\ No newline at end of file
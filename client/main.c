@@ -117,6 +117,13 @@ int main(int argc, char **argv) {
 
                 send_game(gui_out_fd, game_state, hello, players, args.gui_out_info);
 
+            } else if (msg_type == SNAPSHOT) { // we joined in the middle of a game
+                ENSURE(state == GAME);
+                struct msg_snapshot snapshot = parse_snapshot(srv_fd);
+                apply_snapshot(game_state, &snapshot, &hello);
+
+                send_game(gui_out_fd, game_state, hello, players, args.gui_out_info);
+
             } else if (msg_type == GAME_ENDED) {
                 ENSURE(state == GAME);
                 struct msg_score *scores = parse_game_ended(srv_fd);
@@ -149,6 +149,65 @@ struct msg_turn parse_turn(int sockfd) {
     return result;
 }
 
+// Receive a list of `elem_size`-byte elements preceded by its length.
+static struct list *parse_list(int sockfd, size_t elem_size) {
+    list_len_t list_len = 0;
+    recv(sockfd, &list_len, sizeof list_len, MSG_WAITALL);
+    list_len = ntohl(list_len);
+
+    struct list *list = malloc(sizeof(struct list));
+    ENSURE(list != NULL);
+    list->size = list_len;
+    list->arr = malloc(list_len * elem_size);
+    if (list_len > 0)
+        ENSURE(list->arr != NULL);
+
+    recv(sockfd, list->arr, list_len * elem_size, MSG_WAITALL);
+
+    return list;
+}
+
+struct msg_snapshot parse_snapshot(int sockfd) {
+    struct msg_snapshot snapshot;
+    memset(&snapshot, 0, sizeof snapshot);
+
+    recv(sockfd, &snapshot.turn, sizeof snapshot.turn, MSG_WAITALL);
+    snapshot.turn = ntohs(snapshot.turn);
+
+    // robots' positions
+    map_len_t map_len;
+    recv(sockfd, &map_len, sizeof map_len, MSG_WAITALL);
+    map_len = ntohl(map_len);
+    snapshot.players_count = map_len;
+
+    for (map_len_t i = 0; i < map_len; i++) {
+        player_id_t id;
+        struct position pos;
+        recv(sockfd, &id, sizeof id, MSG_WAITALL);
+        recv(sockfd, &pos, sizeof pos, MSG_WAITALL);
+        if (id < MAX_CLIENT_COUNT)
+            snapshot.players[id] = pos;
+    }
+
+    // scores
+    recv(sockfd, &map_len, sizeof map_len, MSG_WAITALL);
+    map_len = ntohl(map_len);
+
+    for (map_len_t i = 0; i < map_len; i++) {
+        player_id_t id;
+        score_t score;
+        recv(sockfd, &id, sizeof id, MSG_WAITALL);
+        recv(sockfd, &score, sizeof score, MSG_WAITALL);
+        if (id < MAX_CLIENT_COUNT)
+            snapshot.scores[id] = ntohl(score);
+    }
+
+    snapshot.blocks = parse_list(sockfd, sizeof(struct position));
+    snapshot.bombs = parse_list(sockfd, sizeof(struct msg_bomb));
+
+    return snapshot;
+}
+
 struct msg_score *parse_game_ended(int sockfd) {
     map_len_t scores_count;
     recv(sockfd, &scores_count, sizeof scores_count, MSG_WAITALL);
@@ -264,7 +323,7 @@ void serialize_explosions(buffer_t *buffer, struct game_state *state, uint16_t s
             int y = ntohs(curr_bomb->pos.y);
             int dx = 0, dy = 1; // vector
 
-            hmap_remove(state->bombs, key, true);
+            remove_bomb(state, key);
             explosions[x][y] = true;
 
             if (state->blocked[x][y])
@@ -29,6 +29,7 @@
 #define GAME_STARTED    2
 #define TURN            3
 #define GAME_ENDED      4
+#define SNAPSHOT        5
 
 // constants for event types
 #define BOMB_PLACED     0
@@ -106,6 +107,23 @@ struct msg_turn {
     struct list *event_list;
 };
 
+struct __attribute__((packed)) msg_bomb {
+    bomb_id_t bomb_id;
+    struct position pos;
+    uint16_t timer;
+};
+
+// The state of a game after the turn `turn`, which late joiners get instead of all the turns
+// before it. Positions are kept in network byte order, like in `Turn` messages.
+struct msg_snapshot {
+    uint16_t turn;
+    map_len_t players_count;
+    struct position players[MAX_CLIENT_COUNT]; // indexed by player ids
+    score_t scores[MAX_CLIENT_COUNT];          // indexed by player ids
+    struct list *blocks;                       // of `struct position`
+    struct list *bombs;                        // of `struct msg_bomb`
+};
+
 struct __attribute__((packed)) msg_score {
     player_id_t player_id;
     score_t score;
@@ -124,6 +142,8 @@ void parse_game_started(int sockfd, struct msg_player players[]);
 
 struct msg_turn parse_turn(int sockfd);
 
+struct msg_snapshot parse_snapshot(int sockfd);
+
 struct msg_score *parse_game_ended(int sockfd);
 
 struct msg_input parse_input(int sockfd);
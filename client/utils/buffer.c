@@ -1,33 +1,89 @@
 #include "buffer.h"
 
 #include <string.h>
+#include <arpa/inet.h>
 
 #include "err.h"
 
 buffer_t *buffer_new() {
-    buffer_t *buffer = malloc(sizeof *buffer);
+    return buffer_with_capacity(BUFFER_INLINE_CAPACITY);
+}
+
+buffer_t *buffer_with_capacity(size_t capacity) {
+    buffer_t *buffer = malloc(sizeof *buffer + capacity);
     ENSURE(buffer != NULL);
 
-    buffer->buf = malloc(BASE_CAPACITY * sizeof *buffer);
-    ENSURE(buffer->buf != NULL);
-    buffer->capacity = BASE_CAPACITY;
+    buffer->buf = (char *) (buffer + 1);
+    buffer->capacity = capacity;
     buffer->size = 0;
+    buffer->storage = BUFFER_INLINE;
 
     return buffer;
 }
 
+void buffer_borrow(buffer_t *buffer, void *storage, size_t capacity) {
+    buffer->buf = storage;
+    buffer->capacity = capacity;
+    buffer->size = 0;
+    buffer->storage = BUFFER_BORROWED;
+}
+
 void buffer_free(buffer_t *buffer) {
-    free(buffer->buf);
+    if (buffer && buffer->storage == BUFFER_HEAP)
+        free(buffer->buf);
     free(buffer);
 }
 
-void buffer_push(buffer_t *buffer, void *data, size_t size) {
-    if (buffer->size + size >= buffer->capacity) {
-        buffer->capacity *= 2;
-        buffer->buf = realloc(buffer->buf, buffer->capacity * sizeof *buffer->buf);
+void buffer_reserve(buffer_t *buffer, size_t size) {
+    if (buffer->size + size <= buffer->capacity)
+        return;
+
+    ENSURE(buffer->storage != BUFFER_BORROWED);
+
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : BUFFER_INLINE_CAPACITY;
+    while (buffer->size + size > capacity)
+        capacity *= 2;
+
+    if (buffer->storage == BUFFER_HEAP) {
+        buffer->buf = realloc(buffer->buf, capacity);
         ENSURE(buffer->buf != NULL);
+    } else {
+        // the inline storage can't grow, so the contents move out of it for good
+        char *buf = malloc(capacity);
+        ENSURE(buf != NULL);
+        memcpy(buf, buffer->buf, buffer->size);
+        buffer->buf = buf;
+        buffer->storage = BUFFER_HEAP;
     }
+    buffer->capacity = capacity;
+}
+
+void buffer_push(buffer_t *buffer, void *data, size_t size) {
+    buffer_reserve(buffer, size);
 
     memcpy(buffer->buf + buffer->size, data, size);
     buffer->size += size;
-}
\ No newline at end of file
+}
+
+void buffer_push_u8(buffer_t *buffer, uint8_t value) {
+    buffer_push(buffer, &value, sizeof value);
+}
+
+void buffer_push_u16(buffer_t *buffer, uint16_t value) {
+    value = htons(value);
+    buffer_push(buffer, &value, sizeof value);
+}
+
+void buffer_push_u32(buffer_t *buffer, uint32_t value) {
+    value = htonl(value);
+    buffer_push(buffer, &value, sizeof value);
+}
+
+void buffer_push_pos(buffer_t *buffer, uint16_t x, uint16_t y) {
+    uint16_t pos[] = {htons(x), htons(y)};
+    buffer_push(buffer, pos, sizeof pos);
+}
+
+void buffer_clear(buffer_t *buffer) {
+    buffer->size = 0;
+}
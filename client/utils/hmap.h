@@ -5,12 +5,16 @@
 #include <sys/types.h>
 #include <stdint.h>
 
+// A map from `uint32_t` keys to non-NULL values, which grows as needed.
 typedef struct HashMap hmap_t;
 
 hmap_t* hmap_new();
 
 void hmap_free(hmap_t* map, bool value_is_alloc);
 
+// Remove all elements, keeping the memory for new ones.
+void hmap_clear(hmap_t* map, bool value_is_alloc);
+
 void* hmap_get(hmap_t* map, uint32_t key);
 
 bool hmap_insert(hmap_t* map, uint32_t key, void* value);
@@ -18,8 +22,7 @@ bool hmap_insert(hmap_t* map, uint32_t key, void* value);
 bool hmap_remove(hmap_t* map, uint32_t key, bool value_is_alloc);
 
 typedef struct HashMapIterator {
-    int bucket;
-    void* pair;
+    size_t slot;
 } hmap_it_t;
 
 hmap_it_t hmap_iterator(hmap_t* map);
@@ -29,12 +32,14 @@ hmap_it_t hmap_iterator(hmap_t* map);
 // If there are no more elements, leaves `*key` and `*value` unchanged and
 // returns false.
 //
-// The map cannot be modified between calls to `hmap_iterator` and `hmap_next`.
+// Removing elements between calls to `hmap_iterator` and `hmap_next`, including
+// the one just returned, is fine. Inserting elements invalidates the iterator,
+// as the map might get rebuilt.
 //
 // Usage: ```
-//     const char* key;
+//     uint32_t key;
 //     void* value;
-//     HashMapIterator it = hmap_iterator(map);
+//     hmap_it_t it = hmap_iterator(map);
 //     while (hmap_next(map, &it, &key, &value))
 //         foo(key, value);
 // ```
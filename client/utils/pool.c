@@ -0,0 +1,79 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+#include "err.h"
+
+struct slab {
+    struct slab *next;
+    max_align_t items[]; // suitably aligned for any item
+};
+
+pool_t *pool_new(size_t item_size, size_t slab_items) {
+    pool_t *pool = malloc(sizeof *pool);
+    ENSURE(pool != NULL);
+
+    // keep every item big enough for a link and aligned like the start of a slab
+    size_t align = _Alignof(max_align_t);
+    if (item_size < sizeof(void *))
+        item_size = sizeof(void *);
+    pool->item_size = (item_size + align - 1) / align * align;
+
+    pool->slab_items = slab_items;
+    pool->slabs = NULL;
+    pool->current = NULL;
+    pool->used = 0;
+    pool->released = NULL;
+
+    return pool;
+}
+
+void pool_free(pool_t *pool) {
+    for (struct slab *slab = pool->slabs; slab;) {
+        struct slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    free(pool);
+}
+
+void *pool_alloc(pool_t *pool) {
+    if (pool->released) {
+        void *item = pool->released;
+        pool->released = *(void **) item;
+        return item;
+    }
+
+    if (!pool->current || pool->used == pool->slab_items) {
+        struct slab *next = pool->current ? pool->current->next : pool->slabs;
+
+        // all slabs are in use, so add one at the end of the list
+        if (!next) {
+            next = malloc(sizeof *next + pool->slab_items * pool->item_size);
+            ENSURE(next != NULL);
+            next->next = NULL;
+
+            if (pool->current)
+                pool->current->next = next;
+            else
+                pool->slabs = next;
+        }
+
+        pool->current = next;
+        pool->used = 0;
+    }
+
+    return (char *) pool->current->items + pool->item_size * pool->used++;
+}
+
+void pool_release(pool_t *pool, void *item) {
+    *(void **) item = pool->released;
+    pool->released = item;
+}
+
+void pool_clear(pool_t *pool) {
+    // the slabs are handed out again from the first one
+    pool->current = NULL;
+    pool->used = 0;
+    pool->released = NULL;
+}
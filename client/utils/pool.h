@@ -0,0 +1,33 @@
+#ifndef ROBOTS_POOL
+#define ROBOTS_POOL
+
+#include <stddef.h>
+
+// Fixed-size items handed out of big slabs, which are kept until the pool is freed.
+// Released items get reused first, so there's no allocation once the slabs are warm.
+struct slab;
+
+typedef struct pool {
+    size_t item_size;     // rounded up, so that a released item can hold a link
+    size_t slab_items;    // number of items per slab
+    struct slab *slabs;   // all slabs, in the order they're handed out
+    struct slab *current; // the slab being handed out, or NULL before the first one
+    size_t used;          // items of `current` handed out so far
+    void *released;       // items given back since the last clear, linked through their first bytes
+} pool_t;
+
+// Create a pool of items of `item_size` bytes, allocated `slab_items` at a time.
+pool_t *pool_new(size_t item_size, size_t slab_items);
+
+void pool_free(pool_t *pool);
+
+// Return an uninitialized item.
+void *pool_alloc(pool_t *pool);
+
+// Give back an item returned by `pool_alloc()`.
+void pool_release(pool_t *pool, void *item);
+
+// Give back all items at once, in O(1) time.
+void pool_clear(pool_t *pool);
+
+#endif // ROBOTS_POOL
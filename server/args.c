@@ -63,6 +63,29 @@ void print_help_info(char *prog_name) {
     DECLARE_HELP_ITEM("-s, --seed <seed>",
                       "A seed for predefining random behaviors, such as initial game board generation.");
 
+    DECLARE_HELP_ITEM("-g, --rng <lcg|xoshiro>",
+                      "The random number generator. \"lcg\", the default, gives the same games "
+                      "for a seed as earlier versions of the server; \"xoshiro\" is faster.");
+
+    DECLARE_HELP_ITEM("-r, --rooms <count>",
+                      "Number of games hosted at the same time. Defaults to 1.");
+
+    DECLARE_HELP_ITEM("-t, --threads <count>",
+                      "Number of worker threads the rooms are spread over. Defaults to 1.");
+
+    DECLARE_HELP_ITEM("-j, --blast-threads <count>",
+                      "Number of threads, shared by all rooms, helping to work out turns in which "
+                      "many bombs explode at once. Defaults to 0, i.e. no help.");
+
+    DECLARE_HELP_ITEM("-i, --snapshot-interval <turns>",
+                      "Number of turns between snapshots of the game sent to late joiners, instead of "
+                      "all the turns so far. Snapshots are an extension of the protocol, a message "
+                      "of type 5, which only clients supporting it understand. Defaults to 0, "
+                      "i.e. no snapshots.");
+
+    DECLARE_HELP_ITEM("-v, --verbose",
+                      "Report on the standard error how late each turn ended, compared to its schedule.");
+
     unsigned long max_first_width = 0;
     for (int i = 0; i < HELP_ITEM_COUNT; i += 2)
         max_first_width = strlen(HELP_ITEM(i)) > max_first_width ? strlen(HELP_ITEM(i)) : max_first_width;
@@ -92,20 +115,28 @@ void free_args(struct prog_args args) {
 struct prog_args parse_args(int argc, char **argv) {
     struct prog_args args;
     memset(&args, 0, sizeof(args));
+    args.rooms = 1;
+    args.threads = 1;
 
     struct option long_options[] = {
-        {"help",             no_argument, &args.help_flag, 'h'},
-        {"bomb-timer",       required_argument, NULL,      'b'},
-        {"players-count",    required_argument, NULL,      'c'},
-        {"turn-duration",    required_argument, NULL,      'd'},
-        {"explosion-radius", required_argument, NULL,      'e'},
-        {"initial-blocks",   required_argument, NULL,      'k'},
-        {"game-length",      required_argument, NULL,      'l'},
-        {"server-name",      required_argument, NULL,      'n'},
-        {"port",             required_argument, NULL,      'p'},
-        {"seed",             required_argument, NULL,      's'},
-        {"size-x",           required_argument, NULL,      'x'},
-        {"size-y",           required_argument, NULL,      'y'},
+        {"help",              no_argument, &args.help_flag, 'h'},
+        {"bomb-timer",        required_argument, NULL,      'b'},
+        {"players-count",     required_argument, NULL,      'c'},
+        {"turn-duration",     required_argument, NULL,      'd'},
+        {"explosion-radius",  required_argument, NULL,      'e'},
+        {"rng",               required_argument, NULL,      'g'},
+        {"snapshot-interval", required_argument, NULL,      'i'},
+        {"blast-threads",     required_argument, NULL,      'j'},
+        {"initial-blocks",    required_argument, NULL,      'k'},
+        {"game-length",       required_argument, NULL,      'l'},
+        {"server-name",       required_argument, NULL,      'n'},
+        {"port",              required_argument, NULL,      'p'},
+        {"rooms",             required_argument, NULL,      'r'},
+        {"seed",              required_argument, NULL,      's'},
+        {"size-x",            required_argument, NULL,      'x'},
+        {"size-y",            required_argument, NULL,      'y'},
+        {"threads",           required_argument, NULL,      't'},
+        {"verbose",           no_argument,       NULL,      'v'},
         {0, 0,                            0,               0}
     };
 
@@ -114,7 +145,7 @@ struct prog_args parse_args(int argc, char **argv) {
 
     while (true) {
         int option_index = 0;
-        int c = getopt_long(argc, argv, "hb:c:d:e:k:l:n:p:s:x:y:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "hb:c:d:e:g:i:j:k:l:n:p:r:s:t:vx:y:", long_options, &option_index);
 
         if (c == -1)
             break;
@@ -147,13 +178,32 @@ struct prog_args parse_args(int argc, char **argv) {
                     fatal("Invalid arg: explosion-radius");
                 break;
 
+            case 'g':
+                if (strcmp(optarg, "lcg") == 0)
+                    args.rng = RANDOM_LCG;
+                else if (strcmp(optarg, "xoshiro") == 0)
+                    args.rng = RANDOM_XOSHIRO;
+                else
+                    fatal("Invalid arg: rng");
+                break;
+
+            case 'i':
+                if (!str_to_num(optarg, &args.snapshot_interval, UINT16_MAX))
+                    fatal("Invalid arg: snapshot-interval");
+                break;
+
+            case 'j':
+                if (!str_to_num(optarg, &args.blast_threads, UINT16_MAX))
+                    fatal("Invalid arg: blast-threads");
+                break;
+
             case 'k':
                 if (!str_to_num(optarg, &args.initial_blocks, UINT16_MAX))
                     fatal("Invalid arg: initial-blocks");
                 break;
 
             case 'l':
-                if (!str_to_num(optarg, &args.game_length, UINT16_MAX))
+                if (!str_to_num(optarg, &args.game_length, UINT16_MAX) || args.game_length == 0)
                     fatal("Invalid arg: game-length");
                 break;
 
@@ -171,12 +221,26 @@ struct prog_args parse_args(int argc, char **argv) {
                 args.port = parse_port(optarg);
                 break;
 
+            case 'r':
+                if (!str_to_num(optarg, &args.rooms, UINT16_MAX) || args.rooms == 0)
+                    fatal("Invalid arg: rooms");
+                break;
+
             case 's':
                 if (!str_to_num(optarg, &args.seed, UINT32_MAX))
                     fatal("Invalid arg: seed");
                 args.provided_seed = true;
                 break;
 
+            case 't':
+                if (!str_to_num(optarg, &args.threads, UINT16_MAX) || args.threads == 0)
+                    fatal("Invalid arg: threads");
+                break;
+
+            case 'v':
+                args.verbose = true;
+                break;
+
             case 'x':
                 if (!str_to_num(optarg, &args.size_x, UINT16_MAX))
                     fatal("Invalid arg: size-x");
@@ -197,6 +261,12 @@ struct prog_args parse_args(int argc, char **argv) {
         for (int i = 0; long_options[i].name; i++) {
             if (long_options[i].val != 'h'
                 && long_options[i].val != 's'
+                && long_options[i].val != 'g'
+                && long_options[i].val != 'r'
+                && long_options[i].val != 't'
+                && long_options[i].val != 'i'
+                && long_options[i].val != 'j'
+                && long_options[i].val != 'v'
                 && !provided[long_options[i].val - 'a']) {
                 free_args(args);
                 fatal("missing argument: %s", long_options[i].name);
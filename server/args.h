@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "utils/random.h"
+
 struct prog_args {
     char *server_name;
     uint8_t players_count;
@@ -18,6 +20,13 @@ struct prog_args {
     uint16_t port;
     uint32_t seed;
     bool provided_seed;
+    enum random_kind rng;
+    uint16_t rng_stream; // how many times the RNG jumps ahead after being seeded
+    uint16_t rooms;
+    uint16_t threads;
+    uint16_t blast_threads;
+    uint16_t snapshot_interval;
+    bool verbose;
     int help_flag;
 };
 
@@ -0,0 +1,472 @@
+#include "engine.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "utils/random.h"
+#include "utils/buffer.h"
+#include "utils/err.h"
+
+// Sizes of encoded events, for sizing the buffers of turns up front.
+#define PLAYER_MOVED_SIZE (sizeof(msg_type_t) + sizeof(player_id_t) + sizeof(struct position))
+#define BLOCK_PLACED_SIZE (sizeof(msg_type_t) + sizeof(struct position))
+#define BOMB_PLACED_SIZE (sizeof(msg_type_t) + sizeof(bomb_id_t) + sizeof(struct position))
+
+// Keep the events of the current turn for the rest of the game, and give back
+// everything else the turn used.
+static void keep_turn(struct game_state *state, buffer_t *events) {
+    buffer_t *turn_buf = &state->turn_bufs[state->turn];
+    buffer_borrow(turn_buf, arena_alloc(state->game_arena, events->size), events->size);
+    buffer_push(turn_buf, events->buf, events->size);
+
+    arena_reset(state->turn_arena);
+}
+
+// how many positions `start_game()` draws at once; no fewer than the players
+#define START_POS_BATCH 256
+
+static void start_game(struct game_state *state, struct prog_args *args) {
+    reset_state(state, args);
+
+    size_t capacity = sizeof(list_len_t) + args->players_count * PLAYER_MOVED_SIZE
+                      + args->initial_blocks * BLOCK_PLACED_SIZE;
+    buffer_t events;
+    buffer_borrow(&events, arena_alloc(state->turn_arena, capacity), capacity);
+
+    list_len_t events_count = args->players_count;
+    buffer_push_u32(&events, 0); // filled in at the end
+
+    // positions are drawn in batches, in the same order as one by one
+    uint16_t coords[2 * START_POS_BATCH];
+    random_pos_fill(&state->rng, coords, args->players_count, args->size_x, args->size_y);
+
+    for (player_id_t id = 0; id < args->players_count; id++) {
+        buffer_push_u8(&events, PLAYER_MOVED);
+        buffer_push_u8(&events, id);
+
+        struct position pos = {coords[2 * id], coords[2 * id + 1]};
+        place_player(state, id, pos);
+        buffer_push_pos(&events, pos.x, pos.y);
+    }
+
+    for (int start = 0; start < args->initial_blocks; start += START_POS_BATCH) {
+        int n = args->initial_blocks - start < START_POS_BATCH ? args->initial_blocks - start : START_POS_BATCH;
+        random_pos_fill(&state->rng, coords, (size_t) n, args->size_x, args->size_y);
+
+        for (int i = 0; i < n; i++) {
+            struct position pos = {coords[2 * i], coords[2 * i + 1]};
+
+            if (!board_get(state->blocked, pos.x, pos.y)) {
+                events_count++;
+
+                buffer_push_u8(&events, BLOCK_PLACED);
+
+                set_block(state, pos.x, pos.y);
+                buffer_push_pos(&events, pos.x, pos.y);
+            }
+        }
+    }
+
+    events_count = htonl(events_count);
+    memcpy(events.buf, &events_count, sizeof events_count);
+
+    keep_turn(state, &events);
+    state->turn = 1;
+}
+
+// At most one bomb per robot explodes in a turn, but on a big board with a long explosion
+// radius each of them scans long rays. Explosions are only handed out to the thread pool,
+// one by one, if the rays to scan are long enough in total to be worth waking it up.
+#define PARALLEL_MIN_REACH (1 << 18)
+
+// Everything a single bomb's blast reaches, found against the board as it was before
+// any bomb exploded this turn. Robots are listed whether or not an earlier bomb already
+// destroyed them, so explosions can be worked out independently of each other.
+struct explosion {
+    bomb_id_t id;
+    struct position pos;
+    uint8_t n_robots;
+    uint8_t n_blocks;
+    player_id_t robots[MAX_CLIENT_COUNT]; // in the order the blast reaches them
+    struct position blocks[4];
+};
+
+// Append the ids of all robots standing on (x,y) to the explosion's list.
+static void hit_robots_at(struct game_state *state, uint16_t x, uint16_t y, struct explosion *explosion) {
+    uint32_t on_tile = players_at(state, x, y);
+
+    while (on_tile) {
+        explosion->robots[explosion->n_robots++] = (player_id_t) __builtin_ctz(on_tile);
+        on_tile &= on_tile - 1;
+    }
+}
+
+// Append the ids of all robots standing on the first `reach` tiles of a blast ray going
+// from (x,y) in the direction (dx,dy), in the same order as calling `hit_robots_at()`
+// on these tiles one by one would.
+static void hit_robots_on_ray(struct game_state *state, struct prog_args *args, uint16_t x, uint16_t y,
+                              int dx, int dy, uint16_t reach, struct explosion *explosion) {
+    if (reach <= args->players_count) {
+        for (int j = 1; j <= reach; j++)
+            hit_robots_at(state, (uint16_t) (x + j * dx), (uint16_t) (y + j * dy), explosion);
+        return;
+    }
+
+    // the ray is long, so it's cheaper to check every robot than every tile
+    struct {
+        int dist;
+        player_id_t id;
+    } hits[MAX_CLIENT_COUNT];
+    int n_hits = 0;
+
+    for (player_id_t id = 0; id < args->players_count; id++) {
+        struct position pos = state->player_pos[id];
+        int dist = dx == 0 ? (pos.y - y) * dy : (pos.x - x) * dx;
+        bool on_line = dx == 0 ? pos.x == x : pos.y == y;
+        if (!on_line || dist < 1 || dist > reach)
+            continue;
+
+        // insertion sort by distance; ids are visited in ascending order, so ties stay sorted
+        int i = n_hits++;
+        for (; i > 0 && hits[i - 1].dist > dist; i--)
+            hits[i] = hits[i - 1];
+        hits[i].dist = dist;
+        hits[i].id = id;
+    }
+
+    for (int i = 0; i < n_hits; i++)
+        explosion->robots[explosion->n_robots++] = hits[i].id;
+}
+
+// Work out what the bomb's blast reaches. Only reads the game state, which doesn't
+// change until all of the turn's explosions are worked out.
+static void resolve_explosion(struct game_state *state, struct prog_args *args, struct explosion *explosion) {
+    // coordinates of the bomb
+    uint16_t x = explosion->pos.x;
+    uint16_t y = explosion->pos.y;
+    int dx = 0, dy = 1; // vector
+
+    // check for robots on the bomb's tile
+    hit_robots_at(state, x, y, explosion);
+
+    if (board_get(state->blocked, x, y)) { // bomb exploded on a blocked square
+        explosion->blocks[explosion->n_blocks++] = explosion->pos;
+        return;
+    }
+
+    // bomb exploded on a free square
+    for (int i = 0; i < 4; i++) {
+        // the explosion covers tiles (x + j * dx, y + j * dy) for 1 <= j <= reach
+        bool hits_block;
+        uint16_t reach = blast_reach(state, x, y, dx, dy, args->explosion_radius, &hits_block);
+
+        // check for robots
+        hit_robots_on_ray(state, args, x, y, dx, dy, reach, explosion);
+
+        // check if a block was destroyed
+        if (hits_block) {
+            struct position pos = {(uint16_t) (x + reach * dx), (uint16_t) (y + reach * dy)};
+            explosion->blocks[explosion->n_blocks++] = pos;
+        }
+
+        // rotate the vector by 90 degrees clockwise
+        int temp = dx;
+        dx = dy;
+        dy = -temp;
+    }
+}
+
+struct resolve_ctx {
+    struct game_state *state;
+    struct prog_args *args;
+    struct explosion *explosions;
+};
+
+static void resolve_explosions(void *arg, size_t begin, size_t end) {
+    struct resolve_ctx *ctx = arg;
+
+    for (size_t i = begin; i < end; i++)
+        resolve_explosion(ctx->state, ctx->args, &ctx->explosions[i]);
+}
+
+// Append the `BombExploded` event of a worked out explosion to `events`. Robots destroyed
+// by an earlier bomb are left out, so explosions have to be committed in the bombs' order.
+static void commit_explosion(struct game_state *state, struct explosion *explosion, buffer_t *events) {
+    buffer_push_u8(events, BOMB_EXPLODED);
+    buffer_push_u32(events, explosion->id);
+
+    // the `robots_destroyed` list
+    player_id_t robots[MAX_CLIENT_COUNT];
+    list_len_t robots_count = 0;
+    for (int i = 0; i < explosion->n_robots; i++) {
+        player_id_t id = explosion->robots[i];
+        if (state->is_dead[id]) // skip already destroyed robots
+            continue;
+
+        state->is_dead[id] = true;
+        robots[robots_count++] = id;
+    }
+
+    buffer_push_u32(events, robots_count);
+    buffer_push(events, robots, robots_count * sizeof *robots);
+
+    // the `blocks_destroyed` list
+    buffer_push_u32(events, explosion->n_blocks);
+    for (int i = 0; i < explosion->n_blocks; i++)
+        buffer_push_pos(events, explosion->blocks[i].x, explosion->blocks[i].y);
+}
+
+// Return the size of the `BombExploded` event of a worked out explosion, at most.
+static size_t explosion_event_size(struct explosion *explosion) {
+    return sizeof(msg_type_t) + sizeof(bomb_id_t) + 2 * sizeof(list_len_t)
+           + explosion->n_robots * sizeof(player_id_t) + explosion->n_blocks * sizeof(struct position);
+}
+
+// Put the events of the bombs exploding this turn into `*events`, a buffer in the turn arena
+// with room left for the events of the robots' actions.
+static void analyze_bombs(struct game_state *state, struct prog_args *args, thread_pool_t *pool, buffer_t *events) {
+    list_len_t list_len = 0;
+    bomb_id_t key;
+    struct bomb_state curr_bomb;
+
+    // only the bombs exploding this turn are touched here
+    size_t n_explosions = count_exploding_bombs(state);
+    struct explosion *explosions = arena_alloc(state->turn_arena, n_explosions * sizeof *explosions);
+    for (size_t i = 0; pop_exploding_bomb(state, &key, &curr_bomb); i++) {
+        struct explosion explosion = {.id = key, .pos = curr_bomb.pos};
+        explosions[i] = explosion;
+    }
+
+    // first work out every explosion on its own, possibly spread over the pool's
+    // threads, and only then put their events together, in the bombs' order
+    struct resolve_ctx ctx = {state, args, explosions};
+
+    if (pool && n_explosions * args->explosion_radius >= PARALLEL_MIN_REACH)
+        thread_pool_run(pool, n_explosions, 1, resolve_explosions, &ctx);
+    else
+        resolve_explosions(&ctx, 0, n_explosions);
+
+    // every robot gets destroyed and placed anew at most once, and takes one action
+    size_t capacity = sizeof list_len + args->players_count * (PLAYER_MOVED_SIZE + BOMB_PLACED_SIZE);
+    for (size_t i = 0; i < n_explosions; i++)
+        capacity += explosion_event_size(&explosions[i]);
+    buffer_borrow(events, arena_alloc(state->turn_arena, capacity), capacity);
+    buffer_push_u32(events, 0); // filled in at the end
+
+    for (size_t i = 0; i < n_explosions; i++) {
+        commit_explosion(state, &explosions[i], events);
+        list_len++;
+    }
+
+    // blocks are only removed once all bombs exploded
+    for (size_t i = 0; i < n_explosions; i++) {
+        for (int j = 0; j < explosions[i].n_blocks; j++)
+            unset_block(state, explosions[i].blocks[j].x, explosions[i].blocks[j].y);
+    }
+
+    // process the `is_dead` array
+    for (player_id_t id = 0; id < args->players_count; id++) {
+        if (state->is_dead[id]) {
+            struct position new_pos = {random_pos_next(&state->rng, args->size_x),
+                                       random_pos_next(&state->rng, args->size_y)};
+            move_player(state, id, new_pos);
+
+            buffer_push_u8(events, PLAYER_MOVED);
+            buffer_push_u8(events, id);
+            buffer_push_pos(events, new_pos.x, new_pos.y);
+
+            list_len++;
+        }
+    }
+
+    // not in net byte order! will be used by `analyze_actions()`
+    memcpy(events->buf, &list_len, sizeof list_len);
+}
+
+static void analyze_actions(struct game_state *state, struct prog_args *args, buffer_t *buffer) {
+    list_len_t list_len;
+    memcpy(&list_len, buffer->buf, sizeof list_len); // pull events count from the buffer
+
+    for (player_id_t id = 0; id < args->players_count; id++) {
+        switch (state->actions[id].type) {
+            case PLACE_BOMB:;
+                struct position bomb_pos = state->player_pos[id];
+                bomb_id_t bomb_id = place_bomb(state, bomb_pos, args);
+
+                buffer_push_u8(buffer, BOMB_PLACED);
+                buffer_push_u32(buffer, bomb_id);
+                buffer_push_pos(buffer, bomb_pos.x, bomb_pos.y);
+
+                list_len++;
+                break;
+
+            case PLACE_BLOCK:;
+                struct position pos = state->player_pos[id];
+                set_block(state, pos.x, pos.y);
+
+                buffer_push_u8(buffer, BLOCK_PLACED);
+                buffer_push_pos(buffer, pos.x, pos.y);
+
+                list_len++;
+                break;
+
+            case MOVE:
+                if (state->is_dead[id])
+                    break;
+
+                int vec_x = 0, vec_y = 1;
+
+                // rotate the vector until we get the deserved result
+                for (int i = 0; i < state->actions[id].direction; i++) {
+                    int temp = vec_x;
+                    vec_x = vec_y;
+                    vec_y = -temp;
+                }
+
+                // construct new player position
+                int32_t new_x = state->player_pos[id].x + vec_x;
+                int32_t new_y = state->player_pos[id].y + vec_y;
+
+                // check if out of bounds
+                if (new_x < 0 || new_x >= args->size_x
+                    || new_y < 0 || new_y >= args->size_y)
+                    break;
+
+                // check if trying to walk onto a block
+                if (board_get(state->blocked, (uint16_t) new_x, (uint16_t) new_y))
+                    break;
+
+                struct position new_pos = {(uint16_t) new_x, (uint16_t) new_y};
+                move_player(state, id, new_pos);
+
+                buffer_push_u8(buffer, PLAYER_MOVED);
+                buffer_push_u8(buffer, id);
+                buffer_push_pos(buffer, new_pos.x, new_pos.y);
+
+                list_len++;
+                break;
+
+            case NONE:
+            default:
+                break;
+        }
+    }
+
+    list_len = htonl(list_len);
+    memcpy(buffer->buf, &list_len, sizeof list_len);
+}
+
+static void analyze_turn(struct game_state *game_state, struct prog_args *args, thread_pool_t *pool) {
+    buffer_t events;
+    analyze_bombs(game_state, args, pool, &events);
+    analyze_actions(game_state, args, &events);
+    keep_turn(game_state, &events);
+
+    // update scores
+    for (player_id_t id = 0; id < args->players_count; id++)
+        game_state->scores[id] += game_state->is_dead[id] ? 1 : 0;
+
+    // clear all temporary data
+    memset(game_state->actions, 0, sizeof game_state->actions);
+    memset(game_state->is_dead, 0, sizeof game_state->is_dead);
+}
+
+struct engine *engine_new(struct prog_args *args) {
+    struct engine *engine = malloc(sizeof *engine);
+    ENSURE(engine != NULL);
+
+    engine->args = *args;
+    engine->state = init_state(args);
+    engine->pool = NULL;
+    random_start(&engine->state->rng, args->rng, args->seed);
+    for (uint16_t i = 0; i < args->rng_stream; i++)
+        random_jump(&engine->state->rng);
+
+    return engine;
+}
+
+void engine_free(struct engine *engine) {
+    free_state(engine->state);
+    free(engine);
+}
+
+buffer_t *engine_start(struct engine *engine) {
+    start_game(engine->state, &engine->args);
+    return &engine->state->turn_bufs[0];
+}
+
+buffer_t *engine_step(struct engine *engine, const struct msg_action *actions) {
+    struct game_state *state = engine->state;
+    ENSURE(state->turn > 0 && state->turn <= engine->args.game_length);
+
+    memcpy(state->actions, actions, engine->args.players_count * sizeof *actions);
+    analyze_turn(state, &engine->args, engine->pool);
+
+    return &state->turn_bufs[state->turn++];
+}
+
+uint16_t engine_fast_forward(struct engine *engine, const struct msg_action *actions, uint16_t n_turns) {
+    uint16_t played = 0;
+
+    while (played < n_turns && !engine_game_over(engine)) {
+        engine_step(engine, actions + (size_t) played * engine->args.players_count);
+        played++;
+    }
+
+    return played;
+}
+
+void engine_snapshot(struct engine *engine, buffer_t *buffer) {
+    struct game_state *state = engine->state;
+    uint8_t players_count = engine->args.players_count;
+    uint16_t turn = (uint16_t) (state->turn - 1);
+
+    buffer_push_u16(buffer, turn);
+
+    // robots' positions
+    buffer_push_u32(buffer, players_count);
+    for (player_id_t id = 0; id < players_count; id++) {
+        buffer_push_u8(buffer, id);
+        buffer_push_pos(buffer, state->player_pos[id].x, state->player_pos[id].y);
+    }
+
+    // scores
+    buffer_push_u32(buffer, players_count);
+    for (player_id_t id = 0; id < players_count; id++) {
+        buffer_push_u8(buffer, id);
+        buffer_push_u32(buffer, state->scores[id]);
+    }
+
+    // blocks, column by column, with the count filled in at the end
+    size_t count_offset = buffer->size;
+    list_len_t list_len = 0;
+    buffer_push_u32(buffer, list_len);
+    uint16_t last_y = (uint16_t) (engine->args.size_y - 1);
+    for (uint16_t x = 0; x < engine->args.size_x; x++) {
+        int32_t y = board_col_next(state->blocked, x, 0, last_y);
+
+        while (y != -1) {
+            buffer_push_pos(buffer, x, (uint16_t) y);
+            list_len++;
+
+            if (y == last_y)
+                break;
+            y = board_col_next(state->blocked, x, (uint16_t) (y + 1), last_y);
+        }
+    }
+    list_len = htonl(list_len);
+    memcpy(buffer->buf + count_offset, &list_len, sizeof list_len);
+
+    // live bombs, oldest first, with the number of turns left until they explode
+    buffer_push_u32(buffer, state->curr_bomb_id - state->first_bomb_id);
+    for (bomb_id_t id = state->first_bomb_id; id != state->curr_bomb_id; id++) {
+        struct bomb_state *bomb = &state->bombs[id & (state->bombs_capacity - 1)];
+        buffer_push_u32(buffer, id);
+        buffer_push_pos(buffer, bomb->pos.x, bomb->pos.y);
+        buffer_push_u16(buffer, (uint16_t) (bomb->explosion_turn - turn));
+    }
+}
+
+bool engine_game_over(struct engine *engine) {
+    return engine->state->turn > engine->args.game_length;
+}
@@ -0,0 +1,54 @@
+#ifndef ROBOTS_ENGINE
+#define ROBOTS_ENGINE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/buffer.h"
+#include "utils/thread_pool.h"
+#include "game.h"
+#include "msg.h"
+#include "args.h"
+
+// The turn logic of a game, without any sockets or clocks. Turns advance only when
+// `engine_step()` is called, so games can be simulated as fast as the CPU allows.
+//
+// Every turn produces a buffer with the turn's serialized event list, i.e. a `Turn`
+// message without its message type and turn number. The buffers are owned by the engine
+// and stay valid until the next `engine_start()` or `engine_free()`.
+struct engine {
+    struct prog_args args;
+    struct game_state *state;
+
+    // if set, explosions of turns in which many bombs go off at once are worked out
+    // on this pool's threads; not owned by the engine, so it can be shared. NULL by default
+    thread_pool_t *pool;
+};
+
+// Create an engine for games configured by `args`. The RNG is seeded with `args->seed`,
+// then jumps ahead `args->rng_stream` times.
+struct engine *engine_new(struct prog_args *args);
+
+void engine_free(struct engine *engine);
+
+// Start a new game and return the events of its turn 0.
+buffer_t *engine_start(struct engine *engine);
+
+// Play out the next turn with `actions[id]` being the action of the player `id`,
+// and return the events of that turn.
+buffer_t *engine_step(struct engine *engine, const struct msg_action *actions);
+
+// Play out up to `n_turns` turns, stopping early if the game ends. The actions for
+// the i-th of these turns are `actions[i * players_count]` up to
+// `actions[(i + 1) * players_count - 1]`. Returns the number of turns played.
+uint16_t engine_fast_forward(struct engine *engine, const struct msg_action *actions, uint16_t n_turns);
+
+// Append the state of the game after its last played turn to `buffer`, encoded like
+// a `Snapshot` message without its message type: the turn number, the robots' positions,
+// the scores, the blocks and the live bombs with the number of turns until they explode.
+void engine_snapshot(struct engine *engine, buffer_t *buffer);
+
+// Check if all `game_length` turns of the current game were played.
+bool engine_game_over(struct engine *engine);
+
+#endif // ROBOTS_ENGINE
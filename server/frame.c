@@ -0,0 +1,67 @@
+#include "frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/err.h"
+
+struct frame *frame_new() {
+    struct frame *frame = frame_wrap(buffer_new());
+    frame->owns_body = true;
+
+    return frame;
+}
+
+struct frame *frame_with_capacity(size_t capacity) {
+    struct frame *frame = frame_wrap(buffer_with_capacity(capacity));
+    frame->owns_body = true;
+
+    return frame;
+}
+
+struct frame *frame_wrap(buffer_t *body) {
+    struct frame *frame = malloc(sizeof *frame);
+    ENSURE(frame != NULL);
+
+    frame->head_len = 0;
+    frame->body = body;
+    frame->owns_body = false;
+    frame->refs = 1;
+
+    return frame;
+}
+
+void frame_own_body(struct frame *frame) {
+    if (frame->owns_body)
+        return;
+
+    buffer_t *body = buffer_with_capacity(frame->body->size);
+    buffer_push(body, frame->body->buf, frame->body->size);
+    frame->body = body;
+    frame->owns_body = true;
+}
+
+void frame_push_head(struct frame *frame, void *data, size_t size) {
+    ENSURE(frame->head_len + size <= FRAME_HEAD_MAX);
+
+    memcpy(frame->head + frame->head_len, data, size);
+    frame->head_len += size;
+}
+
+size_t frame_size(struct frame *frame) {
+    return frame->head_len + frame->body->size;
+}
+
+struct frame *frame_ref(struct frame *frame) {
+    frame->refs++;
+    return frame;
+}
+
+void frame_unref(struct frame *frame) {
+    if (--frame->refs > 0)
+        return;
+
+    if (frame->owns_body)
+        buffer_free(frame->body);
+    free(frame);
+}
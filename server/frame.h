@@ -0,0 +1,49 @@
+#ifndef ROBOTS_FRAME
+#define ROBOTS_FRAME
+
+#include <stdbool.h>
+
+#include "utils/buffer.h"
+
+#define FRAME_HEAD_MAX 8
+
+// An encoded `server -> client` message. A broadcast is encoded only once, and every
+// connection it's queued to holds a reference to the same frame, until it's written out.
+// The count isn't atomic: a frame created on a worker's simulation thread, like a `Turn`
+// or a `Snapshot`, is handed over whole to the worker through the queue of played ticks,
+// and from then on only the worker touches `refs`. The simulation thread keeps no pointer to it.
+//
+// A frame is sent as its `head` followed by its `body`, gathered in a single write.
+// This lets a message wrap a buffer owned by someone else, without copying it.
+struct frame {
+    char head[FRAME_HEAD_MAX];
+    size_t head_len;
+    buffer_t *body; // mustn't change once the frame is shared
+    bool owns_body;
+    int refs;
+};
+
+// Create a frame with an empty head, an empty body of its own and a single reference.
+struct frame *frame_new();
+
+// Like `frame_new()`, but with room in the body for `capacity` bytes from the start.
+struct frame *frame_with_capacity(size_t capacity);
+
+// Create a frame with an empty head, whose body is `body`, and a single reference.
+// `body` must outlive the frame, unless the frame takes a copy with `frame_own_body()`.
+struct frame *frame_wrap(buffer_t *body);
+
+// Replace a borrowed body by a copy, so that the frame no longer depends on it.
+void frame_own_body(struct frame *frame);
+
+// Append `size` bytes to the head.
+void frame_push_head(struct frame *frame, void *data, size_t size);
+
+size_t frame_size(struct frame *frame);
+
+struct frame *frame_ref(struct frame *frame);
+
+// Drop a reference, freeing the frame once there are none left.
+void frame_unref(struct frame *frame);
+
+#endif // ROBOTS_FRAME
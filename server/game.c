@@ -6,31 +6,38 @@
 
 #include "utils/err.h"
 
+#define GAME_ARENA_BASE_CAPACITY 65536
+#define TURN_ARENA_BASE_CAPACITY 4096
+
+static uint32_t tile_index(struct game_state *state, uint16_t x, uint16_t y) {
+    return (uint32_t) x * state->blocked->size_y + y;
+}
+
 struct game_state *init_state(struct prog_args *args) {
     struct game_state *state = malloc(sizeof *state);
     ENSURE(state != NULL);
 
     state->turn = 0;
 
-    state->turn_bufs = malloc(args->game_length * sizeof *state->turn_bufs);
+    // turns are numbered from 0 up to `game_length` inclusive
+    state->turn_bufs = calloc(args->game_length + 1u, sizeof *state->turn_bufs);
     ENSURE(state->turn_bufs != NULL);
+    state->game_arena = arena_new(GAME_ARENA_BASE_CAPACITY);
+    state->turn_arena = arena_new(TURN_ARENA_BASE_CAPACITY);
 
     memset(state->player_pos, 0, sizeof state->player_pos);
+    state->occupants = hmap_new();
     memset(state->scores, 0, sizeof state->scores);
     memset(state->is_dead, 0, sizeof state->is_dead);
 
-    state->bombs = hmap_new();
+    state->bombs = malloc(BOMBS_BASE_CAPACITY * sizeof *state->bombs);
+    ENSURE(state->bombs != NULL);
+    state->bombs_capacity = BOMBS_BASE_CAPACITY;
+    state->first_bomb_id = 0;
     state->curr_bomb_id = 0;
 
-    state->blocked = malloc(args->size_x * sizeof *state->blocked);
-    ENSURE(state->blocked != NULL);
-    for (int i = 0; i < args->size_x; i++) {
-        state->blocked[i] = malloc(args->size_y * sizeof **state->blocked);
-        ENSURE(state->blocked[i] != NULL);
-
-        for (int j = 0; j < args->size_y; j++)
-            state->blocked[i][j] = false;
-    }
+    state->blocked = board_new(args->size_x, args->size_y);
+    state->blocked_rows = board_new(args->size_y, args->size_x);
 
     return state;
 }
@@ -38,36 +45,148 @@ struct game_state *init_state(struct prog_args *args) {
 void reset_state(struct game_state *state, struct prog_args *args) {
     state->turn = 0; // might be pointless
 
-    for (int i = 0; i < args->game_length; i++)
-        buffer_free(state->turn_bufs[i]);
+    memset(state->turn_bufs, 0, (args->game_length + 1u) * sizeof *state->turn_bufs);
+    arena_reset(state->game_arena);
 
     memset(state->scores, 0, sizeof(state->scores));
 
-    hmap_free(state->bombs, true);
-    state->bombs = hmap_new();
+    hmap_clear(state->occupants, false);
+
+    state->first_bomb_id = 0;
     state->curr_bomb_id = 0;
 
-    for (int i = 0; i < args->size_x; i++) {
-        for (int j = 0; j < args->size_y; j++)
-            state->blocked[i][j] = false;
-    }
+    board_clear(state->blocked);
+    board_clear(state->blocked_rows);
 }
 
-void free_state(struct game_state *state, uint16_t size_x) {
+void free_state(struct game_state *state) {
     free(state->turn_bufs);
-    hmap_free(state->bombs, true);
-    for (int i = 0; i < size_x; i++)
-        free(state->blocked[i]);
-    free(state->blocked);
+    arena_free(state->game_arena);
+    arena_free(state->turn_arena);
+    free(state->bombs);
+    hmap_free(state->occupants, false);
+    board_free(state->blocked);
+    board_free(state->blocked_rows);
     free(state);
 }
 
-struct bomb_state *make_bomb(struct position pos, struct prog_args *args) {
-    struct bomb_state *bomb = malloc(sizeof *bomb);
-    ENSURE(bomb != NULL);
+void set_block(struct game_state *state, uint16_t x, uint16_t y) {
+    board_set(state->blocked, x, y);
+    board_set(state->blocked_rows, y, x);
+}
+
+void unset_block(struct game_state *state, uint16_t x, uint16_t y) {
+    board_unset(state->blocked, x, y);
+    board_unset(state->blocked_rows, y, x);
+}
+
+uint16_t blast_reach(struct game_state *state, uint16_t x, uint16_t y, int dx, int dy,
+                     uint16_t radius, bool *hits_block) {
+    // vertical rays walk along a column of `blocked`, horizontal ones along a column of
+    // `blocked_rows`; `line` is that column and `pos` is the bomb's position within it
+    board_t *board = dx == 0 ? state->blocked : state->blocked_rows;
+    uint16_t line = dx == 0 ? x : y;
+    uint16_t pos = dx == 0 ? y : x;
+    int step = dx + dy;
+
+    // distance to the edge of the board
+    uint16_t edge = step > 0 ? (uint16_t) (board->size_y - 1 - pos) : pos;
+    uint16_t reach = radius < edge ? radius : edge;
+
+    *hits_block = false;
+    if (reach == 0)
+        return 0;
+
+    int32_t block = step > 0
+                    ? board_col_next(board, line, (uint16_t) (pos + 1), (uint16_t) (pos + reach))
+                    : board_col_prev(board, line, (uint16_t) (pos - 1), (uint16_t) (pos - reach));
+
+    if (block == -1)
+        return reach;
+
+    *hits_block = true;
+    return (uint16_t) (block > pos ? block - pos : pos - block);
+}
+
+static struct bomb_state *get_bomb(struct game_state *state, bomb_id_t id) {
+    return &state->bombs[id & (state->bombs_capacity - 1)];
+}
+
+bomb_id_t place_bomb(struct game_state *state, struct position pos, struct prog_args *args) {
+    size_t live_count = (bomb_id_t) (state->curr_bomb_id - state->first_bomb_id);
+
+    if (live_count == state->bombs_capacity) {
+        // the ring buffer is full, so move the live bombs to a bigger one
+        struct bomb_state *old_bombs = state->bombs;
+        size_t old_capacity = state->bombs_capacity;
+
+        state->bombs_capacity *= 2;
+        state->bombs = malloc(state->bombs_capacity * sizeof *state->bombs);
+        ENSURE(state->bombs != NULL);
 
+        for (bomb_id_t id = state->first_bomb_id; id != state->curr_bomb_id; id++)
+            *get_bomb(state, id) = old_bombs[id & (old_capacity - 1)];
+
+        free(old_bombs);
+    }
+
+    bomb_id_t id = state->curr_bomb_id++;
+    struct bomb_state *bomb = get_bomb(state, id);
     bomb->pos = pos;
-    bomb->timer = args->bomb_timer;
+    bomb->explosion_turn = state->turn + args->bomb_timer;
+
+    return id;
+}
+
+size_t count_exploding_bombs(struct game_state *state) {
+    // bombs explode in the order of their ids, so these are the oldest ones
+    bomb_id_t id = state->first_bomb_id;
+    while (id != state->curr_bomb_id && get_bomb(state, id)->explosion_turn == state->turn)
+        id++;
+
+    return (bomb_id_t) (id - state->first_bomb_id);
+}
+
+bool pop_exploding_bomb(struct game_state *state, bomb_id_t *id, struct bomb_state *bomb) {
+    if (state->first_bomb_id == state->curr_bomb_id)
+        return false;
+
+    struct bomb_state *oldest = get_bomb(state, state->first_bomb_id);
+    if (oldest->explosion_turn != state->turn)
+        return false;
+
+    *id = state->first_bomb_id++;
+    *bomb = *oldest;
+    return true;
+}
+
+
+// The bitmasks are stored directly in the map's value pointers, so that no allocations
+// are needed. A tile with nobody on it simply has no entry.
+void place_player(struct game_state *state, player_id_t id, struct position pos) {
+    uint32_t key = tile_index(state, pos.x, pos.y);
+    uintptr_t mask = (uintptr_t) hmap_get(state->occupants, key);
+
+    if (mask)
+        hmap_remove(state->occupants, key, false);
+    hmap_insert(state->occupants, key, (void *) (mask | (uintptr_t) 1 << id));
+
+    state->player_pos[id] = pos;
+}
+
+void move_player(struct game_state *state, player_id_t id, struct position pos) {
+    struct position old_pos = state->player_pos[id];
+    uint32_t key = tile_index(state, old_pos.x, old_pos.y);
+    uintptr_t mask = (uintptr_t) hmap_get(state->occupants, key);
+
+    hmap_remove(state->occupants, key, false);
+    mask &= ~((uintptr_t) 1 << id);
+    if (mask)
+        hmap_insert(state->occupants, key, (void *) mask);
+
+    place_player(state, id, pos);
+}
 
-    return bomb;
+uint32_t players_at(struct game_state *state, uint16_t x, uint16_t y) {
+    return (uint32_t) (uintptr_t) hmap_get(state->occupants, tile_index(state, x, y));
 }
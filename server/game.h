@@ -4,37 +4,87 @@
 #include <stdbool.h>
 
 #include "utils/hmap.h"
+#include "utils/board.h"
+#include "utils/arena.h"
+#include "utils/random.h"
 #include "msg.h"
 #include "net.h"
 #include "args.h"
 
+#define BOMBS_BASE_CAPACITY 64
+
 struct bomb_state {
     struct position pos;
-    uint16_t timer;
+    uint32_t explosion_turn;
 };
 
 struct game_state {
-    uint16_t turn;
-    buffer_t **turn_bufs;
+    // wider than turn numbers, so that it can count past the last turn of the longest game
+    uint32_t turn;
+
+    // the events of each turn played so far, kept in `game_arena` until the next game
+    buffer_t *turn_bufs;
+    arena_t *game_arena;
+
+    // everything else a turn needs, given back at once when the turn is over,
+    // so that a turn doesn't call the allocator once the arenas are big enough
+    arena_t *turn_arena;
+
+    random_t rng;
 
     struct position player_pos[MAX_CLIENT_COUNT];
+    hmap_t *occupants; // tile index -> bitmask of ids of the robots standing on it
     struct msg_action actions[MAX_CLIENT_COUNT];
     score_t scores[MAX_CLIENT_COUNT];
     bool is_dead[MAX_CLIENT_COUNT];
 
-    hmap_t *bombs;
+    // All bombs share the same timer, so they explode in the order they were placed.
+    // Live bombs are the ones with ids in [first_bomb_id, curr_bomb_id), kept in a ring
+    // buffer where the bomb `id` lives at index `id % bombs_capacity`.
+    struct bomb_state *bombs;
+    size_t bombs_capacity; // always a power of two
+    bomb_id_t first_bomb_id;
     bomb_id_t curr_bomb_id;
-    bool **blocked;
+    board_t *blocked;
+    // Transposed copy of `blocked`, i.e. (y,x) is set iff (x,y) is blocked. Rows of the
+    // board are columns in here, so rays along both axes can be scanned a word at a time.
+    board_t *blocked_rows;
 };
 
 struct game_state *init_state(struct prog_args *args);
 
-void free_state(struct game_state *state, uint16_t size_x);
+void free_state(struct game_state *state);
 
 void reset_state(struct game_state *state, struct prog_args *args);
 
-player_id_t find_player(uint16_t x, uint16_t y, struct game_state *state, uint8_t players_count);
+// Put the robot `id` on `pos`, without taking it off the tile it previously stood on.
+// Meant for robots which aren't on the board yet, i.e. right after `reset_state()`.
+void place_player(struct game_state *state, player_id_t id, struct position pos);
+
+// Move the robot `id` from its current tile to `pos`.
+void move_player(struct game_state *state, player_id_t id, struct position pos);
+
+// Return a bitmask of ids of all robots standing on the tile (x,y).
+uint32_t players_at(struct game_state *state, uint16_t x, uint16_t y);
+
+void set_block(struct game_state *state, uint16_t x, uint16_t y);
+
+void unset_block(struct game_state *state, uint16_t x, uint16_t y);
+
+// Return how many tiles a blast ray going from (x,y) in the direction (dx,dy) covers,
+// given that it stops at the board's edge or on the first block in its way.
+// If it stops on a block, `*hits_block` is set to true.
+uint16_t blast_reach(struct game_state *state, uint16_t x, uint16_t y, int dx, int dy,
+                     uint16_t radius, bool *hits_block);
+
+// Place a new bomb on `pos` and return its id.
+bomb_id_t place_bomb(struct game_state *state, struct position pos, struct prog_args *args);
+
+// Return the number of live bombs which explode this turn.
+size_t count_exploding_bombs(struct game_state *state);
 
-struct bomb_state *make_bomb(struct position pos, struct prog_args *args);
+// If the oldest live bomb explodes this turn, remove it, copy it into `*bomb`, set `*id`
+// and return true. Otherwise return false.
+bool pop_exploding_bomb(struct game_state *state, bomb_id_t *id, struct bomb_state *bomb);
 
 #endif
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #include "utils/err.h"
 #include "net.h"
+#include "frame.h"
 #include "utils/buffer.h"
 #include "utils/hmap.h"
 
@@ -13,27 +14,68 @@
 /**                    Deserialization                       */
 /** ******************************************************** */
 
-char *parse_string(int *sockfd) {
-    str_len_t len;
-    recv_check(sockfd, &len, sizeof len);
-
-    char *str = malloc((sizeof len + len) * sizeof *str);
-    ENSURE(str != NULL);
-    memcpy(str, &len, sizeof len);
-    recv_check(sockfd, str + sizeof len, len);
-
-    return str;
+void parser_init(struct msg_parser *parser) {
+    parser->state = PARSE_TYPE;
+    parser->name_got = 0;
 }
 
-struct msg_action parse_action(int *sockfd, msg_type_t action_type) {
-    struct msg_action action;
-
-    action.type = action_type;
+enum parse_result parse_message(struct msg_parser *parser, const char *data, size_t n, size_t *consumed) {
+    size_t pos = 0;
+    enum parse_result result = PARSE_MORE;
+
+    while (pos < n && result == PARSE_MORE) {
+        switch (parser->state) {
+            case PARSE_TYPE:
+                parser->action.type = (uint8_t) data[pos++];
+                parser->action.direction = 0;
+
+                if (parser->action.type == JOIN) {
+                    parser->state = PARSE_NAME_LEN;
+                } else if (parser->action.type == MOVE) {
+                    parser->state = PARSE_DIRECTION;
+                } else if (parser->action.type == PLACE_BOMB || parser->action.type == PLACE_BLOCK) {
+                    result = PARSE_DONE;
+                } else {
+                    result = PARSE_ERROR;
+                }
+                break;
+
+            case PARSE_DIRECTION:
+                parser->action.direction = (uint8_t) data[pos++];
+                result = PARSE_DONE;
+                break;
+
+            case PARSE_NAME_LEN:
+                parser->name[0] = data[pos++];
+                parser->name_got = sizeof(str_len_t);
+                parser->state = PARSE_NAME;
+                break;
+
+            case PARSE_NAME:;
+                size_t name_size = sizeof(str_len_t) + (str_len_t) parser->name[0];
+                size_t chunk = name_size - parser->name_got;
+                if (chunk > n - pos)
+                    chunk = n - pos;
+
+                memcpy(parser->name + parser->name_got, data + pos, chunk);
+                parser->name_got += chunk;
+                pos += chunk;
+                break;
+        }
+
+        // the name is complete, possibly an empty one, right after its length
+        if (parser->state == PARSE_NAME
+            && parser->name_got == sizeof(str_len_t) + (str_len_t) parser->name[0]) {
+            parser->state = PARSE_TYPE;
+            result = PARSE_DONE;
+        }
+    }
 
-    if (action.type == MOVE)
-        recv_check(sockfd, (char *) &action.direction, sizeof action.direction);
+    if (result != PARSE_MORE)
+        parser->state = PARSE_TYPE;
 
-    return action;
+    *consumed = pos;
+    return result;
 }
 
 /** ******************************************************** */
@@ -47,8 +89,13 @@ void serialize_hello(buffer_t *buffer, struct msg_hello hello) {
     buffer_push(buffer, (char *) &hello + sizeof(char *), sizeof hello - sizeof(char *));
 }
 
+// The number of bytes `serialize_player()` pushes.
+static size_t player_size(struct msg_player *player) {
+    return sizeof player->id + 1 + (size_t) (str_len_t) player->name[0] + 1 + (size_t) (str_len_t) player->address[0];
+}
+
 void serialize_player(buffer_t *buffer, struct msg_player *player) {
-    buffer_push(buffer, &player->id, sizeof player->id);
+    buffer_push_u8(buffer, player->id);
 
     str_len_t strlen = (str_len_t) player->name[0];
     buffer_push(buffer, player->name, strlen + 1);
@@ -75,85 +122,62 @@ struct msg_hello build_hello(struct prog_args args) {
     return hello;
 }
 
-void send_hello(int fd, buffer_t *hello_buf) {
-    buffer_t *buffer = buffer_new();
-
-    msg_type_t msg_type = HELLO;
-    buffer_push(buffer, &msg_type, sizeof msg_type);
-    buffer_push(buffer, hello_buf->buf, hello_buf->size);
+struct frame *encode_hello(buffer_t *hello_buf) {
+    struct frame *frame = frame_with_capacity(sizeof(msg_type_t) + hello_buf->size);
 
-    send(fd, buffer->buf, buffer->size, 0);
+    buffer_push_u8(frame->body, HELLO);
+    buffer_push(frame->body, hello_buf->buf, hello_buf->size);
 
-    buffer_free(buffer);
+    return frame;
 }
 
-void send_accepted_player(int fd, struct msg_player *player) {
-    buffer_t *buffer = buffer_new();
+struct frame *encode_accepted_player(struct msg_player *player) {
+    struct frame *frame = frame_with_capacity(sizeof(msg_type_t) + player_size(player));
 
-    msg_type_t msg_type = ACCEPTED_PLAYER;
-    buffer_push(buffer, &msg_type, sizeof msg_type);
-    serialize_player(buffer, player);
+    buffer_push_u8(frame->body, ACCEPTED_PLAYER);
+    serialize_player(frame->body, player);
 
-    send(fd, buffer->buf, buffer->size, 0);
-
-    buffer_free(buffer);
+    return frame;
 }
 
-void send_game_started(int fd, struct msg_player *players, uint8_t players_count) {
-    buffer_t *buffer = buffer_new();
+struct frame *encode_game_started(struct msg_player *players, uint8_t players_count) {
+    size_t size = sizeof(msg_type_t) + sizeof(map_len_t);
+    for (int id = 0; id < players_count; id++)
+        size += player_size(&players[id]);
+    struct frame *frame = frame_with_capacity(size);
 
-    msg_type_t msg_type = GAME_STARTED;
-    buffer_push(buffer, &msg_type, sizeof msg_type);
+    buffer_push_u8(frame->body, GAME_STARTED);
+    buffer_push_u32(frame->body, players_count);
 
-    map_len_t map_len = htonl(players_count);
-    buffer_push(buffer, &map_len, sizeof map_len);
+    for (int id = 0; id < players_count; id++)
+        serialize_player(frame->body, &players[id]);
 
-    for (int i = 1; i < N_FDS; i++) {
-        if (players[i].name)
-            serialize_player(buffer, &players[i]);
-    }
-
-    send(fd, buffer->buf, buffer->size, 0);
-
-    buffer_free(buffer);
+    return frame;
 }
 
-void send_turn(int fd, buffer_t *turn_info, uint16_t turn) {
-    buffer_t *buffer = buffer_new();
+struct frame *encode_turn(buffer_t *turn_info, uint16_t turn) {
+    struct frame *frame = frame_wrap(turn_info);
 
     msg_type_t msg_type = TURN;
-    buffer_push(buffer, &msg_type, sizeof msg_type);
+    frame_push_head(frame, &msg_type, sizeof msg_type);
 
     uint16_t net_turn = htons(turn);
-    buffer_push(buffer, &net_turn, sizeof net_turn);
-
-    buffer_push(buffer, turn_info->buf, turn_info->size);
-
-    send(fd, buffer->buf, buffer->size, 0);
+    frame_push_head(frame, &net_turn, sizeof net_turn);
 
-    buffer_free(buffer);
+    return frame;
 }
 
-void send_turns_recap(int fd, buffer_t **turns, uint16_t turn) {
-    for (uint16_t i = 0; i < turn; i++)
-        send_turn(fd, turns[i], i);
-}
-
-buffer_t *build_game_ended(score_t scores[], uint8_t players_count) {
-    buffer_t *buffer = buffer_new();
+struct frame *encode_game_ended(score_t scores[], uint8_t players_count) {
+    size_t size = sizeof(msg_type_t) + sizeof(map_len_t) + players_count * (sizeof(player_id_t) + sizeof(score_t));
+    struct frame *frame = frame_with_capacity(size);
 
-    msg_type_t msg_type = GAME_ENDED;
-    map_len_t map_len = htonl(players_count);
-
-    buffer_push(buffer, &msg_type, sizeof msg_type);
-    buffer_push(buffer, &map_len, sizeof map_len);
+    buffer_push_u8(frame->body, GAME_ENDED);
+    buffer_push_u32(frame->body, players_count);
 
     for (player_id_t id = 0; id < players_count; id++) {
-        buffer_push(buffer, &id, sizeof id);
-
-        score_t net_score = htonl(scores[id]);
-        buffer_push(buffer, &net_score, sizeof net_score);
+        buffer_push_u8(frame->body, id);
+        buffer_push_u32(frame->body, scores[id]);
     }
 
-    return buffer;
+    return frame;
 }
@@ -6,6 +6,7 @@
 
 #include "utils/buffer.h"
 #include "args.h"
+#include "frame.h"
 
 #define MAX_STR_LEN     255
 
@@ -23,6 +24,7 @@
 #define GAME_STARTED    2
 #define TURN            3
 #define GAME_ENDED      4
+#define SNAPSHOT        5
 
 // constants for event types
 #define BOMB_PLACED     0
@@ -75,9 +77,34 @@ struct __attribute__((packed)) msg_score {
 /**                    Deserialization                       */
 /** ******************************************************** */
 
-char *parse_string(int *sockfd);
+enum parse_state {
+    PARSE_TYPE,
+    PARSE_DIRECTION,
+    PARSE_NAME_LEN,
+    PARSE_NAME
+};
+
+enum parse_result {
+    PARSE_MORE,  // the data ran out in the middle of a message
+    PARSE_DONE,  // a message is complete
+    PARSE_ERROR  // the client sent something which isn't a valid message
+};
+
+// Decoder of `client -> server` messages, fed with bytes as they arrive, in pieces
+// of any size. A message cut in half is kept here until the rest of it comes.
+struct msg_parser {
+    enum parse_state state;
+    struct msg_action action;                   // the message being decoded, unless it's `Join`
+    char name[sizeof(str_len_t) + MAX_STR_LEN]; // the name of `Join`, serialized like a string
+    size_t name_got;                            // the number of bytes of `name` received
+};
+
+void parser_init(struct msg_parser *parser);
 
-struct msg_action parse_action(int *sockfd, msg_type_t msg_type);
+// Consume bytes of `data`, up to `n` of them, stopping right after the first complete
+// message. `*consumed` is set to the number of bytes used. If the result is `PARSE_DONE`,
+// `parser->action.type` is the message's type, and for `Join`, the name is in `parser->name`.
+enum parse_result parse_message(struct msg_parser *parser, const char *data, size_t n, size_t *consumed);
 
 /** ******************************************************** */
 /**                      Serialization                       */
@@ -91,16 +118,18 @@ void serialize_hello(buffer_t *buffer, struct msg_hello hello);
 
 struct msg_hello build_hello(struct prog_args args);
 
-void send_hello(int fd, buffer_t *hello_buf);
+// Each `encode_*()` returns a new frame holding a single reference.
 
-void send_accepted_player(int fd, struct msg_player *player);
+struct frame *encode_hello(buffer_t *hello_buf);
 
-void send_game_started(int fd, struct msg_player *players, uint8_t players_count);
+struct frame *encode_accepted_player(struct msg_player *player);
 
-void send_turn(int fd, buffer_t *turn_info, uint16_t turn);
+// `players[id]` must be the player with the id `id`.
+struct frame *encode_game_started(struct msg_player *players, uint8_t players_count);
 
-void send_turns_recap(int fd, buffer_t **turns, uint16_t turn);
+// The frame borrows `turn_info`, see `frame_wrap()`.
+struct frame *encode_turn(buffer_t *turn_info, uint16_t turn);
 
-buffer_t *build_game_ended(score_t scores[], uint8_t players_count);
+struct frame *encode_game_ended(score_t scores[], uint8_t players_count);
 
 #endif // ROBOTS_MSG
@@ -9,6 +9,9 @@
 #include <netinet/tcp.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 
 #include "utils/err.h"
 #include "msg.h"
@@ -40,17 +43,22 @@ int bind_socket_tcp(uint16_t port) {
     return socket_fd;
 }
 
-void accept_client(int srvfd, int *fd, struct msg_player *player) {
+bool accept_client(int srvfd, int *fd, struct msg_player *player) {
     int client_fd = accept(srvfd, NULL, NULL);
-    ENSURE(client_fd >= 0);
+    if (client_fd < 0)
+        return false;
     *fd = client_fd;
 
-    // set a 1-second timeout for receiving messages, so that we don't block infinitely
-    // after receiving only a part of a message which we expect to contain more info.
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    CHECK(setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof tv));
+    setup_client(client_fd, player);
+    return true;
+}
+
+void setup_client(int client_fd, struct msg_player *player) {
+    // the worker only ever reads what has already arrived, so that a client sending
+    // half of a message can't hold up the whole room
+    int flags = fcntl(client_fd, F_GETFL);
+    ENSURE(flags != -1);
+    CHECK(fcntl(client_fd, F_SETFL, flags | O_NONBLOCK));
 
     // turn off Nagle's algorithm
     int yes = 1;
@@ -58,7 +66,9 @@ void accept_client(int srvfd, int *fd, struct msg_player *player) {
 
     // save the address
     struct sockaddr_in6 client_addr;
-    getpeername(client_fd, (struct sockaddr *) &client_addr, (socklen_t *) sizeof client_addr);
+    socklen_t client_addr_len = sizeof client_addr;
+    if (getpeername(client_fd, (struct sockaddr *) &client_addr, &client_addr_len) != 0)
+        memset(&client_addr, 0, sizeof client_addr); // the client is already gone
     struct in6_addr ip = client_addr.sin6_addr;
 
     // serialize it immediately
@@ -68,35 +78,189 @@ void accept_client(int srvfd, int *fd, struct msg_player *player) {
     char temp[INET6_ADDRSTRLEN];
     inet_ntop(AF_INET6, &ip, temp, INET6_ADDRSTRLEN);
 
-    str_len_t str_len = (str_len_t) sprintf(player->address + 1, "[%s]:%d", temp, client_addr.sin6_port);
+    str_len_t str_len = (str_len_t) sprintf(player->address + 1, "[%s]:%d", temp, ntohs(client_addr.sin6_port));
     memcpy(player->address, &str_len, sizeof str_len);
 
-    player->port = client_addr.sin6_port;
+    player->port = ntohs(client_addr.sin6_port);
+}
+
+void disconnect_client(struct client_sock *sock) {
+    if (sock->deferred) {
+        shutdown(sock->fd, SHUT_RDWR);
+        sock->shut_fd = sock->fd;
+    } else {
+        close(sock->fd);
+    }
+    sock->fd = -1;
 }
 
-void disconnect_client(int *fd) {
-    close(*fd);
-    *fd = -1;
+void sock_init(struct client_sock *sock, int fd) {
+    sock->fd = fd;
+    sock->out = buffer_new();
+    sock->out_first = 0;
+    sock->first_sent = 0;
+    sock->out_bytes = 0;
+    sock->deferred = false;
+    sock->shut_fd = -1;
+    sock->write = NULL;
 }
 
-int recv_check(int *fd, void *buf, size_t n) {
-    errno = 0;
+void sock_free(struct client_sock *sock) {
+    if (sock->fd != -1)
+        close(sock->fd);
+    if (sock->shut_fd != -1)
+        close(sock->shut_fd);
 
-    recv(*fd, buf, n, MSG_WAITALL);
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        disconnect_client(fd);
-        return 1;
+    struct frame **frames = (struct frame **) sock->out->buf;
+    size_t n_frames = sock->out->size / sizeof *frames;
+    for (size_t i = sock->out_first; i < n_frames; i++)
+        frame_unref(frames[i]);
+
+    buffer_free(sock->out);
+    sock->out = NULL;
+    free(sock->write);
+    sock->write = NULL;
+}
+
+void sock_queue(struct client_sock *sock, struct frame *frame) {
+    if (sock->fd == -1)
+        return;
+
+    if (sock->out_bytes + frame_size(frame) > MAX_OUT_QUEUE) {
+        disconnect_client(sock);
+        return;
     }
 
-    return 0;
+    frame_ref(frame);
+    buffer_push(sock->out, &frame, sizeof frame);
+    sock->out_bytes += frame_size(frame);
 }
 
-void socket_flush(const int *fd) {
-    ssize_t read_len;
-    size_t bufsize = 32;
-    char buffer[bufsize];
+void sock_send(struct client_sock *sock, struct frame *frame) {
+    // if something's waiting, the socket was full a moment ago and
+    // the frame will go out along with the rest once it's writable
+    bool was_empty = sock->out_bytes == 0;
+
+    sock_queue(sock, frame);
+    if (was_empty && !sock->deferred)
+        sock_flush(sock);
+}
+
+// Fill `iov` with the unwritten parts of the queued frames and return the number of entries.
+static int gather_frames(struct client_sock *sock, struct iovec *iov, int max_iov) {
+    struct frame **frames = (struct frame **) sock->out->buf;
+    size_t n_frames = sock->out->size / sizeof *frames;
+    size_t skip = sock->first_sent;
+    int n_iov = 0;
+
+    for (size_t i = sock->out_first; i < n_frames && n_iov + 2 <= max_iov; i++) {
+        char *parts[] = {frames[i]->head, frames[i]->body->buf};
+        size_t lens[] = {frames[i]->head_len, frames[i]->body->size};
+
+        for (int p = 0; p < 2; p++) {
+            if (skip >= lens[p]) {
+                skip -= lens[p];
+                continue;
+            }
+
+            iov[n_iov].iov_base = parts[p] + skip;
+            iov[n_iov].iov_len = lens[p] - skip;
+            n_iov++;
+            skip = 0;
+        }
+    }
+
+    return n_iov;
+}
+
+// Release the frames covered by the first `written` bytes of the queue.
+static void consume_frames(struct client_sock *sock, size_t written) {
+    struct frame **frames = (struct frame **) sock->out->buf;
+
+    sock->out_bytes -= written;
+    while (written > 0) {
+        struct frame *first = frames[sock->out_first];
+        size_t left = frame_size(first) - sock->first_sent;
+
+        if (written < left) {
+            sock->first_sent += written;
+            return;
+        }
+
+        written -= left;
+        frame_unref(first);
+        sock->out_first++;
+        sock->first_sent = 0;
+    }
+}
+
+// Drop the written frames from the queue, once there's enough of them.
+static void compact_queue(struct client_sock *sock) {
+    struct frame **frames = (struct frame **) sock->out->buf;
+    size_t n_frames = sock->out->size / sizeof *frames;
+
+    if (sock->out_first == n_frames) {
+        buffer_clear(sock->out);
+        sock->out_first = 0;
+    } else if (sock->out_first > n_frames / 2) {
+        // move the rest to the front, so that the queue doesn't grow without bounds
+        size_t pending = n_frames - sock->out_first;
+        memmove(frames, frames + sock->out_first, pending * sizeof *frames);
+        sock->out->size = pending * sizeof *frames;
+        sock->out_first = 0;
+    }
+}
+
+void sock_flush(struct client_sock *sock) {
+    struct iovec iov[MAX_IOV];
+
+    while (sock->fd != -1 && sock->out_bytes > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t) gather_frames(sock, iov, MAX_IOV);
+
+        ssize_t len = sendmsg(sock->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (len >= 0) {
+            consume_frames(sock, (size_t) len);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            disconnect_client(sock);
+            break;
+        }
+    }
+
+    compact_queue(sock);
+}
+
+struct msghdr *sock_start_write(struct client_sock *sock) {
+    if (sock->write == NULL) {
+        sock->write = malloc(sizeof *sock->write);
+        ENSURE(sock->write != NULL);
+    }
+
+    struct msghdr *msg = &sock->write->msg;
+    memset(msg, 0, sizeof *msg);
+    msg->msg_iov = sock->write->iov;
+    msg->msg_iovlen = (size_t) gather_frames(sock, sock->write->iov, MAX_IOV);
+
+    return msg;
+}
+
+void sock_end_write(struct client_sock *sock, ssize_t result) {
+    if (sock->fd == -1)
+        return;
+
+    if (result >= 0)
+        consume_frames(sock, (size_t) result);
+    else if (result != -EAGAIN && result != -EWOULDBLOCK && result != -EINTR)
+        disconnect_client(sock);
+
+    compact_queue(sock);
+}
 
-    do {
-        read_len = recv(*fd, buffer, bufsize, MSG_DONTWAIT);
-    } while (read_len > 0);
+size_t sock_pending(struct client_sock *sock) {
+    return sock->out_bytes;
 }
@@ -2,24 +2,78 @@
 #define ROBOTS_NET_UTILS
 
 #include <netdb.h>
+#include <stdbool.h>
+#include <sys/socket.h>
 
 #include "utils/buffer.h"
+#include "frame.h"
 
 #define MAX_CLIENT_COUNT    25
-#define QUEUE_LEN           5
-#define N_FDS               MAX_CLIENT_COUNT + 1
+#define QUEUE_LEN           SOMAXCONN
+#define MAX_OUT_QUEUE       (64 * 1024 * 1024) // clients lagging further behind get dropped
+#define MAX_IOV             128                // iovecs gathered per `sendmsg()`
+
+// A write handed to the kernel to complete asynchronously, which has to stay in place until it does.
+struct sock_write {
+    struct msghdr msg;
+    struct iovec iov[MAX_IOV];
+};
+
+// A client's socket, written to without ever blocking. Frames which don't fit
+// into the kernel's buffer wait in `out` until the socket is writable again.
+struct client_sock {
+    int fd;            // -1 once closed
+    buffer_t *out;     // queued `struct frame *`s, each holding a reference
+    size_t out_first;  // index of the first frame in `out` which wasn't fully written
+    size_t first_sent; // the prefix of the first frame which was already written
+    size_t out_bytes;  // the number of bytes still to be written
+
+    bool deferred;            // `sock_send()` only queues, as writes are submitted by the worker
+    int shut_fd;              // if deferred, the fd once shut down and until freed, or -1
+    struct sock_write *write; // storage for those writes, allocated with the first one
+};
 
 uint16_t parse_port(char *string);
 
 int bind_socket_tcp(uint16_t port);
 
 struct msg_player; // forward declaration for `accept_client()`
-void accept_client(int srvfd, int *fd, struct msg_player *player);
 
-void disconnect_client(int *fd);
+// Return false, leaving `errno` set, if no client could be accepted.
+bool accept_client(int srvfd, int *fd, struct msg_player *player);
+
+// Prepare a freshly accepted socket and save its address in `player`.
+void setup_client(int client_fd, struct msg_player *player);
+
+// Mark the socket as closed. A deferred socket is only shut down, and its fd stays open
+// until `sock_free()`, so that the number isn't given to another client while requests
+// the worker prepared or submitted still name it.
+void disconnect_client(struct client_sock *sock);
+
+void sock_init(struct client_sock *sock, int fd);
+
+// Close the socket's fd if it's still open, or only shut down, and release the queued frames.
+void sock_free(struct client_sock *sock);
+
+// Queue the frame with a new reference, without writing anything yet. If the queue
+// grows past `MAX_OUT_QUEUE`, the socket gets closed.
+void sock_queue(struct client_sock *sock, struct frame *frame);
+
+// Queue the frame, and write it right away if nothing was waiting before it.
+void sock_send(struct client_sock *sock, struct frame *frame);
+
+// Write as much of the queue as the socket takes, gathering many frames in each call.
+// On an error, the socket gets closed.
+void sock_flush(struct client_sock *sock);
+
+// Describe the queued output for an asynchronous `sendmsg()`. The returned header stays valid,
+// and no other write may be made, until the result is passed to `sock_end_write()`.
+struct msghdr *sock_start_write(struct client_sock *sock);
 
-int recv_check(int *fd, void *buf, size_t n);
+// Account for the result of a write started with `sock_start_write()`: the number of bytes
+// written, or a negated error code, on which the socket gets closed.
+void sock_end_write(struct client_sock *sock, ssize_t result);
 
-void socket_flush(const int *fd);
+size_t sock_pending(struct client_sock *sock);
 
 #endif // ROBOTS_NET_UTILS
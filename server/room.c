@@ -0,0 +1,464 @@
+#include "room.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "utils/err.h"
+
+#define CONNS_BASE_CAPACITY 32
+#define RECAP_BASE_CAPACITY 16
+#define RECAP_CHUNK_SIZE    (256 * 1024)
+#define RECV_BUF_SIZE       (64 * 1024)
+#define RECV_ROUNDS         4 // per wakeup, so that one flooding client can't starve the others
+
+uint64_t monotonic_us(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000 + (uint64_t) spec.tv_nsec / 1000;
+}
+
+struct room *room_new(int id, struct prog_args *args, buffer_t *hello_buf, thread_pool_t *blast_pool) {
+    struct room *room = malloc(sizeof *room);
+    ENSURE(room != NULL);
+
+    room->id = id;
+    room->hello_frame = encode_hello(hello_buf);
+
+    // every room gets its own sequence; the first one uses the seed as is,
+    // so that a single-room server behaves exactly like before. The LCG keeps seeding
+    // each room differently, as it did, while xoshiro splits a single sequence
+    room->args = *args;
+    if (args->rng == RANDOM_LCG)
+        room->args.seed = args->seed + (uint32_t) id * 2654435769u;
+    else
+        room->args.rng_stream = (uint16_t) id;
+    room->engine = engine_new(&room->args);
+    room->engine->pool = blast_pool;
+
+    atomic_init(&room->state, LOBBY);
+    atomic_init(&room->n_conns, 0);
+    room->conns = malloc(CONNS_BASE_CAPACITY * sizeof *room->conns);
+    ENSURE(room->conns != NULL);
+    room->conns_size = 0;
+    room->conns_capacity = CONNS_BASE_CAPACITY;
+    room->dirty = buffer_new();
+    room->recv_buf = malloc(RECV_BUF_SIZE);
+    ENSURE(room->recv_buf != NULL);
+
+    memset(room->players, 0, sizeof room->players);
+    room->n_players = 0;
+    memset(room->actions, 0, sizeof room->actions);
+    room->game_started_frame = NULL;
+
+    room->turn_frames = malloc(((size_t) args->game_length + 1) * sizeof *room->turn_frames);
+    ENSURE(room->turn_frames != NULL);
+    room->n_turn_frames = 0;
+
+    room->recap = malloc(RECAP_BASE_CAPACITY * sizeof *room->recap);
+    ENSURE(room->recap != NULL);
+    room->recap_size = 0;
+    room->recap_capacity = RECAP_BASE_CAPACITY;
+    room->recap_tail = NULL;
+    room->snapshot_frame = NULL;
+
+    // a duration so long that it would overflow is as good as infinite
+    room->turn_us = args->turn_duration <= UINT64_MAX / 4000 ? args->turn_duration * 1000 : UINT64_MAX / 4;
+    room->next_tick_us = 0;
+    memset(&room->ticks, 0, sizeof room->ticks);
+    room->simulating = false;
+    room->writes_in_flight = 0;
+    room->start_due = false;
+
+    return room;
+}
+
+static void clear_players(struct room *room) {
+    for (int id = 0; id < room->n_players; id++) {
+        free(room->players[id].name);
+        free(room->players[id].address);
+        frame_unref(room->accepted_frames[id]);
+    }
+    memset(room->players, 0, sizeof room->players);
+    room->n_players = 0;
+
+    if (room->game_started_frame != NULL) {
+        frame_unref(room->game_started_frame);
+        room->game_started_frame = NULL;
+    }
+
+    for (size_t i = 0; i < room->conns_size; i++)
+        room->conns[i]->player_id = -1;
+}
+
+// Drop the room's references to the `Turn` frames. The engine's turn buffers are
+// about to go away, so frames still waiting in some queue get copies of their own.
+static void release_turns(struct room *room) {
+    for (uint32_t i = 0; i < room->n_turn_frames; i++) {
+        if (room->turn_frames[i]->refs > 1)
+            frame_own_body(room->turn_frames[i]);
+        frame_unref(room->turn_frames[i]);
+    }
+    room->n_turn_frames = 0;
+}
+
+// Make the chunk being filled immutable, so that it can be queued.
+static void seal_recap(struct room *room) {
+    if (room->recap_tail == NULL)
+        return;
+
+    if (room->recap_size == room->recap_capacity) {
+        room->recap_capacity *= 2;
+        room->recap = realloc(room->recap, room->recap_capacity * sizeof *room->recap);
+        ENSURE(room->recap != NULL);
+    }
+
+    room->recap[room->recap_size++] = room->recap_tail;
+    room->recap_tail = NULL;
+}
+
+static void append_recap(struct room *room, struct frame *turn_frame) {
+    if (room->recap_tail == NULL)
+        room->recap_tail = frame_new();
+
+    buffer_push(room->recap_tail->body, turn_frame->head, turn_frame->head_len);
+    buffer_push(room->recap_tail->body, turn_frame->body->buf, turn_frame->body->size);
+
+    if (room->recap_tail->body->size >= RECAP_CHUNK_SIZE)
+        seal_recap(room);
+}
+
+static void clear_recap(struct room *room) {
+    seal_recap(room);
+    for (size_t i = 0; i < room->recap_size; i++)
+        frame_unref(room->recap[i]);
+    room->recap_size = 0;
+}
+
+static void clear_snapshot(struct room *room) {
+    if (room->snapshot_frame != NULL) {
+        frame_unref(room->snapshot_frame);
+        room->snapshot_frame = NULL;
+    }
+}
+
+// Replace the snapshot by `snapshot_frame`, taken after the last played turn. The recap is then
+// no longer needed, as all of its turns are already accounted for in the snapshot.
+static void replace_snapshot(struct room *room, struct frame *snapshot_frame) {
+    clear_snapshot(room);
+    clear_recap(room);
+    room->snapshot_frame = snapshot_frame;
+}
+
+void room_free(struct room *room) {
+    while (room->conns_size > 0) {
+        struct connection *conn = room->conns[room->conns_size - 1];
+        room_remove_client(room, conn);
+        free(conn);
+    }
+    free(room->conns);
+    buffer_free(room->dirty);
+    free(room->recv_buf);
+    clear_players(room);
+    release_turns(room);
+    free(room->turn_frames);
+    clear_recap(room);
+    free(room->recap);
+    clear_snapshot(room);
+    frame_unref(room->hello_frame);
+    engine_free(room->engine);
+    free(room);
+}
+
+struct connection *room_add_client(struct room *room, int fd, char *address, uint16_t port) {
+    struct connection *conn = malloc(sizeof *conn);
+    ENSURE(conn != NULL);
+
+    conn->room = room;
+    sock_init(&conn->sock, fd);
+    parser_init(&conn->parser);
+    conn->address = address;
+    conn->port = port;
+    conn->player_id = -1;
+    conn->dirty = false;
+    conn->polls_out = false;
+    conn->in_flight = 0;
+    conn->cancelled = false;
+
+    if (room->conns_size == room->conns_capacity) {
+        room->conns_capacity *= 2;
+        room->conns = realloc(room->conns, room->conns_capacity * sizeof *room->conns);
+        ENSURE(room->conns != NULL);
+    }
+    conn->index = room->conns_size;
+    room->conns[room->conns_size++] = conn;
+
+    // immediately send `Hello` to the newly connected client
+    sock_queue(&conn->sock, room->hello_frame);
+
+    // send `AcceptedPlayer` messages if we're in a lobby
+    if (room->state == LOBBY) {
+        for (int id = 0; id < room->n_players; id++)
+            sock_queue(&conn->sock, room->accepted_frames[id]);
+
+    } else { // room->state == GAME
+        sock_queue(&conn->sock, room->game_started_frame);
+        if (room->snapshot_frame != NULL)
+            sock_queue(&conn->sock, room->snapshot_frame);
+
+        // a few big chunks instead of a message per turn
+        seal_recap(room);
+        for (size_t i = 0; i < room->recap_size; i++)
+            sock_queue(&conn->sock, room->recap[i]);
+    }
+
+    // the whole greeting goes out in as few writes as possible
+    sock_flush(&conn->sock);
+
+    room_check_client(room, conn);
+    return conn;
+}
+
+void room_check_client(struct room *room, struct connection *conn) {
+    if (conn->dirty)
+        return;
+
+    // nothing to do if the socket's open and watched for writability exactly when it should be
+    if (conn->sock.fd != -1 && (sock_pending(&conn->sock) > 0) == conn->polls_out)
+        return;
+
+    conn->dirty = true;
+    buffer_push(room->dirty, &conn, sizeof conn);
+}
+
+void room_remove_client(struct room *room, struct connection *conn) {
+    sock_free(&conn->sock);
+
+    // move the last connection into the freed place
+    struct connection *last = room->conns[--room->conns_size];
+    room->conns[conn->index] = last;
+    last->index = conn->index;
+
+    free(conn->address);
+    conn->address = NULL;
+    atomic_fetch_sub(&room->n_conns, 1);
+}
+
+// Queue the frame to all clients of the room.
+static void broadcast(struct room *room, struct frame *frame) {
+    for (size_t i = 0; i < room->conns_size; i++) {
+        sock_send(&room->conns[i]->sock, frame);
+        room_check_client(room, room->conns[i]);
+    }
+}
+
+static void start_game(struct room *room) {
+    // the turn buffers of the last game are about to be reused
+    if (room->writes_in_flight > 0) {
+        room->start_due = true;
+        return;
+    }
+
+    room->start_due = false;
+    room->state = GAME;
+    release_turns(room);
+    clear_recap(room);
+    clear_snapshot(room);
+    buffer_t *turn_buf = engine_start(room->engine);
+    memset(room->actions, 0, sizeof room->actions);
+
+    room->game_started_frame = encode_game_started(room->players, room->args.players_count);
+    broadcast(room, room->game_started_frame);
+
+    room->turn_frames[room->n_turn_frames] = encode_turn(turn_buf, 0);
+    append_recap(room, room->turn_frames[room->n_turn_frames]);
+    broadcast(room, room->turn_frames[room->n_turn_frames++]);
+
+    memset(&room->ticks, 0, sizeof room->ticks);
+    room->next_tick_us = monotonic_us() + room->turn_us;
+}
+
+static void handle_join(struct room *room, struct connection *conn) {
+    if (room->state == GAME || room->start_due || conn->player_id != -1)
+        return;
+
+    // the name and the address are copied, as the player outlives the connection
+    str_len_t name_len = (str_len_t) conn->parser.name[0];
+    char *name = malloc(sizeof name_len + name_len);
+    ENSURE(name != NULL);
+    memcpy(name, conn->parser.name, sizeof name_len + name_len);
+
+    str_len_t address_len = (str_len_t) conn->address[0];
+    char *address = malloc(sizeof address_len + address_len);
+    ENSURE(address != NULL);
+    memcpy(address, conn->address, sizeof address_len + address_len);
+
+    struct msg_player *player = &room->players[room->n_players];
+    player->id = (player_id_t) room->n_players;
+    player->name = name;
+    player->address = address;
+    player->port = conn->port;
+    conn->player_id = room->n_players;
+
+    room->accepted_frames[room->n_players] = encode_accepted_player(player);
+    broadcast(room, room->accepted_frames[room->n_players]);
+    room->n_players++;
+
+    // if enough players signed up, start the game
+    if (room->n_players == room->args.players_count)
+        start_game(room);
+}
+
+static void handle_message(struct room *room, struct connection *conn) {
+    struct msg_action action = conn->parser.action;
+
+    if (action.type == JOIN)
+        handle_join(room, conn);
+    else if (room->state == GAME && conn->player_id != -1)
+        room->actions[conn->player_id] = action;
+}
+
+void room_handle_data(struct room *room, struct connection *conn, const char *data, size_t len) {
+    size_t pos = 0;
+    while (pos < len && conn->sock.fd != -1) {
+        size_t consumed;
+        enum parse_result result = parse_message(&conn->parser, data + pos, len - pos, &consumed);
+        pos += consumed;
+
+        if (result == PARSE_ERROR)
+            disconnect_client(&conn->sock);
+        else if (result == PARSE_DONE)
+            handle_message(room, conn);
+    }
+}
+
+void room_handle_input(struct room *room, struct connection *conn) {
+    // drain the socket with as few reads as possible: a read which doesn't fill
+    // the buffer means that nothing more is waiting. Anything left after the last
+    // round gets picked up on the next wakeup, as epoll keeps reporting the socket.
+    for (int round = 0; round < RECV_ROUNDS && conn->sock.fd != -1; round++) {
+        ssize_t len = recv(conn->sock.fd, room->recv_buf, RECV_BUF_SIZE, MSG_DONTWAIT);
+
+        if (len == 0 || (len == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            disconnect_client(&conn->sock); // the client hung up, or the connection broke
+            break;
+        }
+        if (len == -1)
+            break;
+
+        room_handle_data(room, conn, room->recv_buf, (size_t) len);
+
+        if ((size_t) len < RECV_BUF_SIZE)
+            break;
+    }
+
+    // the socket could have been closed while handling the input
+    room_check_client(room, conn);
+}
+
+static void end_game(struct room *room, score_t *scores) {
+    struct frame *game_ended_frame = encode_game_ended(scores, room->args.players_count);
+    broadcast(room, game_ended_frame);
+    frame_unref(game_ended_frame);
+
+    if (room->args.verbose) {
+        struct tick_stats *ticks = &room->ticks;
+        fprintf(stderr, "room %d: game over after %" PRIu64 " turns, which ended %" PRIu64 " us late on average, "
+                        "%" PRIu64 " us at most, with the schedule moved %" PRIu64 " times\n",
+                room->id, ticks->n_ticks, ticks->n_ticks > 0 ? ticks->total_late_us / ticks->n_ticks : 0,
+                ticks->max_late_us, ticks->n_moved);
+    }
+
+    clear_players(room);
+    room->state = LOBBY;
+}
+
+// Account for a tick which came `late_us` after its deadline, and set the next one.
+static void schedule_tick(struct room *room, uint16_t turn, uint64_t now_us) {
+    uint64_t late_us = now_us - room->next_tick_us;
+    struct tick_stats *ticks = &room->ticks;
+    ticks->n_ticks++;
+    ticks->total_late_us += late_us;
+    if (late_us > ticks->max_late_us)
+        ticks->max_late_us = late_us;
+
+    if (room->args.verbose)
+        fprintf(stderr, "room %d: turn %" PRIu16 " ended %" PRIu64 " us late\n", room->id, turn, late_us);
+
+    // deadlines only ever move by whole turns, so handling the turns doesn't delay the next ones;
+    // but if a whole turn was missed, rather than rushing through the missed turns back to back,
+    // the schedule moves to start over from now
+    room->next_tick_us += room->turn_us;
+    if (now_us >= room->next_tick_us) {
+        room->next_tick_us = now_us + room->turn_us;
+        ticks->n_moved++;
+    }
+}
+
+bool room_tick(struct room *room, struct tick *tick) {
+    // turn ended, time to parse all the data and move on to the next turn
+    uint64_t now_us = monotonic_us();
+    if (room->state != GAME || room->simulating || now_us < room->next_tick_us)
+        return false;
+
+    schedule_tick(room, (uint16_t) room->n_turn_frames, now_us);
+
+    tick->room = room;
+    memcpy(tick->actions, room->actions, sizeof tick->actions);
+    memset(room->actions, 0, sizeof room->actions);
+    room->simulating = true;
+
+    return true;
+}
+
+void room_simulate(struct tick *tick) {
+    struct room *room = tick->room;
+    struct engine *engine = room->engine;
+
+    uint16_t turn = (uint16_t) engine->state->turn;
+    buffer_t *turn_buf = engine_step(engine, tick->actions);
+    tick->turn_frame = encode_turn(turn_buf, turn);
+
+    tick->snapshot_frame = NULL;
+    uint16_t interval = room->args.snapshot_interval;
+    if (interval != 0 && turn % interval == 0) {
+        tick->snapshot_frame = frame_new();
+        msg_type_t msg_type = SNAPSHOT;
+        frame_push_head(tick->snapshot_frame, &msg_type, sizeof msg_type);
+        engine_snapshot(engine, tick->snapshot_frame->body);
+    }
+
+    tick->game_over = engine_game_over(engine);
+    if (tick->game_over)
+        memcpy(tick->scores, engine->state->scores, sizeof tick->scores);
+}
+
+void room_finish_tick(struct tick *tick) {
+    struct room *room = tick->room;
+    room->simulating = false;
+
+    // send `Turn` to all
+    room->turn_frames[room->n_turn_frames] = tick->turn_frame;
+    append_recap(room, room->turn_frames[room->n_turn_frames]);
+    broadcast(room, room->turn_frames[room->n_turn_frames++]);
+
+    if (tick->snapshot_frame != NULL)
+        replace_snapshot(room, tick->snapshot_frame);
+
+    // check if the game has ended
+    if (tick->game_over)
+        end_game(room, tick->scores);
+}
+
+void room_write_done(struct room *room) {
+    room->writes_in_flight--;
+    if (room->writes_in_flight == 0 && room->start_due)
+        start_game(room);
+}
+
+uint64_t room_deadline(struct room *room) {
+    return room->state == GAME && !room->simulating ? room->next_tick_us : UINT64_MAX;
+}
@@ -0,0 +1,172 @@
+#ifndef ROBOTS_ROOM
+#define ROBOTS_ROOM
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "utils/buffer.h"
+#include "engine.h"
+#include "msg.h"
+#include "net.h"
+#include "frame.h"
+#include "args.h"
+
+enum room_state {
+    LOBBY,
+    GAME
+};
+
+// How late the turns of the current game ended, compared to their schedule.
+struct tick_stats {
+    uint64_t n_ticks;
+    uint64_t total_late_us;
+    uint64_t max_late_us;
+    uint64_t n_moved; // times the schedule moved, as a whole turn was missed
+};
+
+struct room; // forward declaration for `struct connection`
+
+struct connection {
+    struct room *room;
+    struct client_sock sock;
+    struct msg_parser parser;
+    char *address;  // serialized like a string
+    uint16_t port;
+    int player_id;  // -1 for spectators
+    size_t index;   // position in the room's `conns`
+    bool dirty;     // listed in the room's `dirty`
+    bool polls_out; // the worker waits for the socket to become writable, or writes to it
+
+    // the worker's asynchronous requests which still refer to the connection,
+    // and whether they were cancelled, as the connection got closed
+    int in_flight;
+    bool cancelled;
+};
+
+// A single game hosted by the server, together with all clients connected to it.
+// A room is only ever touched by the worker thread it belongs to, apart from the atomic
+// fields, which the accepting thread reads to decide where new connections go.
+struct room {
+    int id;
+    struct prog_args args; // the server's args, except for the seed
+    struct frame *hello_frame;
+    struct engine *engine;
+
+    _Atomic enum room_state state;
+    _Atomic int n_conns; // also counts connections handed to the room, but not added yet
+
+    // the connected clients, in no particular order; grows as needed
+    struct connection **conns;
+    size_t conns_size;
+    size_t conns_capacity;
+
+    // connections which got closed, or whose output queue filled up or emptied,
+    // since the worker last looked
+    buffer_t *dirty;
+
+    // where input is read into, shared by all connections; a message cut at its end
+    // is carried over in the connection's parser
+    char *recv_buf;
+
+    struct msg_player players[MAX_CLIENT_COUNT]; // indexed by player ids
+    int n_players;
+
+    // messages replayed to every newcomer, kept encoded
+    struct frame *accepted_frames[MAX_CLIENT_COUNT]; // indexed by player ids
+    struct frame *game_started_frame;                // NULL if there's no game
+
+    // `Turn` messages of the current game, borrowing the engine's turn buffers,
+    // kept to detach the ones still queued before the engine frees the buffers
+    struct frame **turn_frames;
+    uint32_t n_turn_frames; // up to `game_length + 1`
+
+    // the latest `Snapshot` of the current game, or NULL if there wasn't any yet
+    struct frame *snapshot_frame;
+
+    // the messages since the snapshot, encoded back to back, for late joiners: a list of
+    // chunks which are never modified once sealed, and so can be shared by any number of them
+    struct frame **recap;
+    size_t recap_size;
+    size_t recap_capacity;
+    struct frame *recap_tail; // the chunk being filled, or NULL
+    struct msg_action actions[MAX_CLIENT_COUNT]; // actions sent during the current turn
+
+    // turns follow a fixed schedule, one every `turn_us` microseconds from the start of the game,
+    // however long handling them takes
+    uint64_t turn_us;
+    uint64_t next_tick_us; // when the current turn ends, per `monotonic_us()`
+    struct tick_stats ticks;
+
+    // set while a turn is being simulated, during which the engine
+    // belongs to the simulation thread and mustn't be touched
+    bool simulating;
+
+    // asynchronous writes of the worker, prepared or in flight, which may still read
+    // the engine's turn buffers through the queued `Turn` frames. While there are any,
+    // a new game, which would reuse those buffers, waits with `start_due` set
+    int writes_in_flight;
+    bool start_due;
+};
+
+// A turn on its way to be simulated away from the clients' I/O, and back.
+struct tick {
+    struct room *room;
+    struct msg_action actions[MAX_CLIENT_COUNT];
+
+    // filled in by `room_simulate()`
+    struct frame *turn_frame;
+    struct frame *snapshot_frame; // NULL unless a snapshot was due
+    bool game_over;
+    score_t scores[MAX_CLIENT_COUNT]; // only if `game_over`
+};
+
+// `blast_pool`, if not NULL, helps the room's engine with turns in which many bombs explode.
+struct room *room_new(int id, struct prog_args *args, buffer_t *hello_buf, thread_pool_t *blast_pool);
+
+void room_free(struct room *room);
+
+// Add a freshly accepted connection to the room, greet it and return it.
+// `address` becomes owned by the room.
+struct connection *room_add_client(struct room *room, int fd, char *address, uint16_t port);
+
+// Handle everything the client `conn` sent, without blocking. Only complete messages
+// are acted upon. If the client misbehaves or hangs up, its socket gets closed.
+void room_handle_input(struct room *room, struct connection *conn);
+
+// Act upon every complete message among `len` bytes which were received from `conn`.
+// The socket might get closed, but `room_check_client()` is left to the caller.
+void room_handle_data(struct room *room, struct connection *conn, const char *data, size_t len);
+
+// Add `conn` to `room->dirty` if it got closed, or if it should start
+// or stop being watched for writability.
+void room_check_client(struct room *room, struct connection *conn);
+
+// Close the client's socket if it's still open, and take it off the room's list.
+// The `conn` struct itself is left to the caller to free.
+void room_remove_client(struct room *room, struct connection *conn);
+
+// If the current turn is over, fill `tick` with what's needed to play it out and return true.
+// Until the tick comes back to `room_finish_tick()`, the room goes on without its engine.
+bool room_tick(struct room *room, struct tick *tick);
+
+// Play out the turn, encoding its messages. This only uses the room's engine,
+// so it can run on another thread while the room handles its clients.
+void room_simulate(struct tick *tick);
+
+// Send out the messages of the played turn, and end the game if it's over.
+void room_finish_tick(struct tick *tick);
+
+// Tell the room that one of its `writes_in_flight` is done,
+// and start the game if it was only waiting for that.
+void room_write_done(struct room *room);
+
+// Return the time at which the current turn is over, per `monotonic_us()`, or `UINT64_MAX`
+// if there's no game in progress, or if the last turn is still being played out.
+uint64_t room_deadline(struct room *room);
+
+// The current time of `CLOCK_MONOTONIC`, in microseconds.
+uint64_t monotonic_us(void);
+
+#endif // ROBOTS_ROOM
@@ -0,0 +1,223 @@
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "utils/err.h"
+
+// without these, the server would have to fall back to the poll-based loop anyway
+#define REQUIRED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned n_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, n_args);
+}
+
+bool uring_init(struct uring *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+
+    ring->fd = sys_setup(entries, &params);
+    if (ring->fd < 0)
+        return false; // no kernel support, or it's disabled
+
+    if ((params.features & REQUIRED_FEATURES) != REQUIRED_FEATURES) {
+        close(ring->fd);
+        return false;
+    }
+
+    // both queues live in a single mapping, the submission entries in another one
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring->fd, IORING_OFF_SQ_RING);
+    ENSURE(ring->rings != MAP_FAILED);
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    ENSURE(ring->sqes != MAP_FAILED);
+
+    char *rings = ring->rings;
+    ring->sq_head = (unsigned *) (rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (rings + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *) (rings + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (rings + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->to_submit = 0;
+
+    ring->cq_head = (unsigned *) (rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (rings + params.cq_off.cqes);
+
+    return true;
+}
+
+void uring_free(struct uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    unsigned tail = *ring->sq_tail;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+        int submitted = sys_enter(ring->fd, ring->to_submit, 0, 0, NULL, 0);
+        ENSURE(submitted > 0);
+        ring->to_submit -= (unsigned) submitted;
+    }
+
+    unsigned index = tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    ring->sq_array[index] = index;
+
+    // the kernel only looks at the entry once it's filled, during the next submission
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+
+    return sqe;
+}
+
+int uring_wait(struct uring *ring, int64_t timeout_us) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    if (timeout_us != -1)
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    int submitted = sys_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                              &arg, sizeof arg);
+    if (submitted < 0)
+        return -errno; // `ETIME` if nothing completed in time, or interrupted by a signal
+
+    ring->to_submit -= (unsigned) submitted;
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek(struct uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_seen(struct uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Put the buffer `bid` at the tail of the ring, without publishing it yet.
+static void bufs_add(struct uring_bufs *bufs, uint16_t bid, uint16_t offset) {
+    uint16_t mask = (uint16_t) (bufs->n_bufs - 1);
+    struct io_uring_buf *buf = &bufs->ring->bufs[(bufs->ring->tail + offset) & mask];
+
+    // field by field, as the first entry's `resv` is the ring's tail
+    buf->addr = (uint64_t) (uintptr_t) (bufs->data + (size_t) bid * bufs->buf_size);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+}
+
+bool uring_bufs_init(struct uring *ring, struct uring_bufs *bufs, uint16_t group,
+                     uint16_t n_bufs, uint32_t buf_size) {
+    bufs->group = group;
+    bufs->n_bufs = n_bufs;
+    bufs->buf_size = buf_size;
+
+    // the ring has to be page-aligned
+    bufs->ring_size = n_bufs * sizeof(struct io_uring_buf);
+    bufs->ring = mmap(NULL, bufs->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ENSURE(bufs->ring != MAP_FAILED);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr = (uint64_t) (uintptr_t) bufs->ring;
+    reg.ring_entries = n_bufs;
+    reg.bgid = group;
+
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        munmap(bufs->ring, bufs->ring_size);
+        return false;
+    }
+
+    bufs->data = malloc((size_t) n_bufs * buf_size);
+    ENSURE(bufs->data != NULL);
+
+    bufs->ring->tail = 0;
+    for (uint16_t bid = 0; bid < n_bufs; bid++)
+        bufs_add(bufs, bid, bid);
+    __atomic_store_n(&bufs->ring->tail, n_bufs, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+void uring_bufs_free(struct uring *ring, struct uring_bufs *bufs) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.bgid = bufs->group;
+    sys_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+    munmap(bufs->ring, bufs->ring_size);
+    free(bufs->data);
+}
+
+char *uring_buf(struct uring_bufs *bufs, struct io_uring_cqe *cqe) {
+    uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    return bufs->data + (size_t) bid * bufs->buf_size;
+}
+
+void uring_buf_recycle(struct uring_bufs *bufs, struct io_uring_cqe *cqe) {
+    bufs_add(bufs, (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT), 0);
+    __atomic_store_n(&bufs->ring->tail, (uint16_t) (bufs->ring->tail + 1), __ATOMIC_RELEASE);
+}
+
+bool uring_supported(void) {
+    struct uring ring;
+    if (!uring_init(&ring, 4))
+        return false;
+
+    // multishot receives came last of all the features used, so try one out
+    struct uring_bufs bufs;
+    int fds[2];
+    bool supported = false;
+
+    if (uring_bufs_init(&ring, &bufs, 0, 1, 16)) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+            struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fds[0];
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = bufs.group;
+
+            struct io_uring_cqe *cqe;
+            if (write(fds[1], "?", 1) == 1 && uring_wait(&ring, 1000000) == 0 && (cqe = uring_peek(&ring)) != NULL)
+                supported = cqe->res == 1 && (cqe->flags & IORING_CQE_F_BUFFER) && (cqe->flags & IORING_CQE_F_MORE);
+
+            close(fds[0]);
+            close(fds[1]);
+        }
+        uring_bufs_free(&ring, &bufs);
+    }
+
+    uring_free(&ring); // also cancels the receive
+    return supported;
+}
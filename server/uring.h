@@ -0,0 +1,77 @@
+#ifndef ROBOTS_URING
+#define ROBOTS_URING
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// A minimal io_uring instance, driven directly through the system calls.
+// Only ever used by a single thread.
+struct uring {
+    int fd;
+
+    // the submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned to_submit; // filled entries which the kernel wasn't told about yet
+
+    // the completion queue, shared with the kernel
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *rings;
+    size_t rings_size;
+    size_t sqes_size;
+};
+
+// A group of equally sized buffers, out of which the kernel picks one whenever data
+// arrives for a request which asked for it. Buffers get back to the kernel once recycled.
+struct uring_bufs {
+    struct io_uring_buf_ring *ring;
+    size_t ring_size;
+    char *data;
+    uint16_t group;
+    uint16_t n_bufs; // a power of 2
+    uint32_t buf_size;
+};
+
+// Check if the kernel supports everything the server needs: multishot requests,
+// provided buffers and waiting with a timeout.
+bool uring_supported(void);
+
+// Return false if the kernel refuses to set up a ring.
+bool uring_init(struct uring *ring, unsigned entries);
+
+void uring_free(struct uring *ring);
+
+// Return a zeroed submission entry to fill. If the queue is full, it's submitted first.
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// Submit the filled entries and wait until there's a completion, or until `timeout_us`
+// microseconds have passed, unless it's -1. Return 0, or a negated error code.
+int uring_wait(struct uring *ring, int64_t timeout_us);
+
+// Return the oldest completion, or NULL if there's none. It stays valid until `uring_seen()`.
+struct io_uring_cqe *uring_peek(struct uring *ring);
+
+void uring_seen(struct uring *ring);
+
+bool uring_bufs_init(struct uring *ring, struct uring_bufs *bufs, uint16_t group,
+                     uint16_t n_bufs, uint32_t buf_size);
+
+void uring_bufs_free(struct uring *ring, struct uring_bufs *bufs);
+
+// Return the buffer the kernel filled for `cqe`.
+char *uring_buf(struct uring_bufs *bufs, struct io_uring_cqe *cqe);
+
+// Give the buffer filled for `cqe` back to the kernel.
+void uring_buf_recycle(struct uring_bufs *bufs, struct io_uring_cqe *cqe);
+
+#endif // ROBOTS_URING
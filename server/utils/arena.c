@@ -0,0 +1,81 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+#include "err.h"
+
+#define ALIGN _Alignof(max_align_t)
+
+struct chunk {
+    struct chunk *prev; // the chunk filled before this one, or NULL
+    size_t capacity;
+    max_align_t data[];
+};
+
+struct arena {
+    struct chunk *chunk; // the chunk being filled
+    size_t used;         // bytes of `chunk` handed out
+    size_t total;        // capacities of all chunks together
+};
+
+static struct chunk *chunk_new(size_t capacity, struct chunk *prev) {
+    struct chunk *chunk = malloc(sizeof *chunk + capacity);
+    ENSURE(chunk != NULL);
+
+    chunk->prev = prev;
+    chunk->capacity = capacity;
+    return chunk;
+}
+
+arena_t *arena_new(size_t capacity) {
+    arena_t *arena = malloc(sizeof *arena);
+    ENSURE(arena != NULL);
+
+    arena->chunk = chunk_new(capacity, NULL);
+    arena->used = 0;
+    arena->total = capacity;
+
+    return arena;
+}
+
+static void free_chunks(struct chunk *chunk) {
+    while (chunk) {
+        struct chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+}
+
+void arena_free(arena_t *arena) {
+    free_chunks(arena->chunk);
+    free(arena);
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ALIGN - 1) / ALIGN * ALIGN;
+
+    if (arena->used + size > arena->chunk->capacity) {
+        size_t capacity = arena->chunk->capacity * 2;
+        if (capacity < size)
+            capacity = size;
+
+        arena->chunk = chunk_new(capacity, arena->chunk);
+        arena->used = 0;
+        arena->total += capacity;
+    }
+
+    void *ptr = (char *) arena->chunk->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+void arena_reset(arena_t *arena) {
+    arena->used = 0;
+
+    if (arena->chunk->prev == NULL)
+        return;
+
+    // the arena outgrew its first chunk, so make a single one big enough from now on
+    free_chunks(arena->chunk);
+    arena->chunk = chunk_new(arena->total, NULL);
+}
@@ -0,0 +1,23 @@
+#ifndef ROBOTS_ARENA
+#define ROBOTS_ARENA
+
+#include <stddef.h>
+
+// Memory handed out by bumping a pointer, and given back all at once by `arena_reset()`.
+// Allocations never move. When a chunk runs out, another one twice as big is added;
+// a reset then merges the chunks into a single one with room for everything allocated
+// before it, so that doing the same work again doesn't touch the heap at all.
+typedef struct arena arena_t;
+
+// Create an arena whose first chunk has room for `capacity` bytes.
+arena_t *arena_new(size_t capacity);
+
+void arena_free(arena_t *arena);
+
+// Return `size` uninitialized bytes, aligned for any type, valid until the next reset.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Give back everything allocated so far.
+void arena_reset(arena_t *arena);
+
+#endif // ROBOTS_ARENA
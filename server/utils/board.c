@@ -0,0 +1,61 @@
+#include "board.h"
+
+#include <string.h>
+
+#include "err.h"
+
+board_t *board_new(uint16_t size_x, uint16_t size_y) {
+    board_t *board = malloc(sizeof *board);
+    ENSURE(board != NULL);
+
+    board->size_x = size_x;
+    board->size_y = size_y;
+    board->words_per_col = ((size_t) size_y + BOARD_WORD_BITS - 1) / BOARD_WORD_BITS;
+
+    // `calloc()` so that a fresh board is already empty
+    board->words = calloc(size_x * board->words_per_col, sizeof *board->words);
+    ENSURE(board->words != NULL);
+
+    return board;
+}
+
+void board_free(board_t *board) {
+    if (board)
+        free(board->words);
+    free(board);
+}
+
+void board_clear(board_t *board) {
+    memset(board->words, 0, board->size_x * board->words_per_col * sizeof *board->words);
+}
+
+int32_t board_col_next(const board_t *board, uint16_t x, uint16_t from, uint16_t to) {
+    size_t k = from / BOARD_WORD_BITS;
+    size_t last_k = to / BOARD_WORD_BITS;
+    uint64_t word = board_col_word(board, x, k) & (~(uint64_t) 0 << (from % BOARD_WORD_BITS));
+
+    while (!word) {
+        if (k == last_k)
+            return -1;
+        word = board_col_word(board, x, ++k);
+    }
+
+    size_t y = k * BOARD_WORD_BITS + (size_t) __builtin_ctzll(word);
+    return y <= to ? (int32_t) y : -1;
+}
+
+int32_t board_col_prev(const board_t *board, uint16_t x, uint16_t from, uint16_t to) {
+    size_t k = from / BOARD_WORD_BITS;
+    size_t last_k = to / BOARD_WORD_BITS;
+    uint64_t word = board_col_word(board, x, k)
+                    & (~(uint64_t) 0 >> (BOARD_WORD_BITS - 1 - from % BOARD_WORD_BITS));
+
+    while (!word) {
+        if (k == last_k)
+            return -1;
+        word = board_col_word(board, x, --k);
+    }
+
+    size_t y = k * BOARD_WORD_BITS + BOARD_WORD_BITS - 1 - (size_t) __builtin_clzll(word);
+    return y >= to ? (int32_t) y : -1;
+}
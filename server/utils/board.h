@@ -0,0 +1,52 @@
+#ifndef ROBOTS_BOARD
+#define ROBOTS_BOARD
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define BOARD_WORD_BITS 64
+
+// A bit-packed `size_x` by `size_y` grid of flags, stored in one contiguous allocation.
+// Tiles are laid out column by column (like `bool[size_x][size_y]`), and every column
+// is padded to a whole number of words, so a column word covers 64 consecutive `y`s.
+typedef struct board {
+    uint64_t *words;
+    size_t words_per_col;
+    uint16_t size_x;
+    uint16_t size_y;
+} board_t;
+
+board_t *board_new(uint16_t size_x, uint16_t size_y);
+
+void board_free(board_t *board);
+
+// Unset every tile of the board.
+void board_clear(board_t *board);
+
+// Return the bits of tiles `(x, 64 * k)` up to `(x, 64 * k + 63)`, lowest bit first.
+// Bits past `size_y` are always unset.
+static inline uint64_t board_col_word(const board_t *board, uint16_t x, size_t k) {
+    return board->words[x * board->words_per_col + k];
+}
+
+// Return the smallest `y` in [from, to] such that (x,y) is set, or -1 if there is none.
+int32_t board_col_next(const board_t *board, uint16_t x, uint16_t from, uint16_t to);
+
+// Return the largest `y` in [to, from] such that (x,y) is set, or -1 if there is none.
+// Note that here `from >= to`, as the column is scanned downwards.
+int32_t board_col_prev(const board_t *board, uint16_t x, uint16_t from, uint16_t to);
+
+static inline bool board_get(const board_t *board, uint16_t x, uint16_t y) {
+    return (board_col_word(board, x, y / BOARD_WORD_BITS) >> (y % BOARD_WORD_BITS)) & 1;
+}
+
+static inline void board_set(board_t *board, uint16_t x, uint16_t y) {
+    board->words[x * board->words_per_col + y / BOARD_WORD_BITS] |= (uint64_t) 1 << (y % BOARD_WORD_BITS);
+}
+
+static inline void board_unset(board_t *board, uint16_t x, uint16_t y) {
+    board->words[x * board->words_per_col + y / BOARD_WORD_BITS] &= ~((uint64_t) 1 << (y % BOARD_WORD_BITS));
+}
+
+#endif // ROBOTS_BOARD
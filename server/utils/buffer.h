@@ -1,22 +1,52 @@
 #ifndef ROBOTS_BUFFER
 #define ROBOTS_BUFFER
 
+#include <stdint.h>
 #include <stdlib.h>
 
-#define BASE_CAPACITY 256
+// Bytes stored in the same allocation as a buffer created by `buffer_new()`,
+// which is enough for most messages to never need another one.
+#define BUFFER_INLINE_CAPACITY 64
+
+enum buffer_storage {
+    BUFFER_INLINE,   // allocated together with the buffer, and moved to the heap once outgrown
+    BUFFER_HEAP,     // a heap allocation of its own, owned by the buffer
+    BUFFER_BORROWED, // someone else's memory, which the buffer can't grow out of
+};
 
 typedef struct buffer {
     char *buf;
     size_t capacity;
     size_t size;
+    enum buffer_storage storage;
 } buffer_t;
 
+// Create an empty buffer with room for `BUFFER_INLINE_CAPACITY` bytes.
 buffer_t *buffer_new();
 
+// Create an empty buffer with room for `capacity` bytes, all in a single allocation.
+buffer_t *buffer_with_capacity(size_t capacity);
+
+// Set up `*buffer` as an empty buffer over `capacity` bytes of `storage`, which stays
+// owned by the caller. Pushing more than that is a fatal error. Such a buffer mustn't
+// be passed to `buffer_free()`.
+void buffer_borrow(buffer_t *buffer, void *storage, size_t capacity);
+
 void buffer_free(buffer_t *buffer);
 
+// Make sure that `size` more bytes can be pushed without growing the buffer again.
+void buffer_reserve(buffer_t *buffer, size_t size);
+
 void buffer_push(buffer_t *buffer, void *data, size_t size);
 
+// Push integers in network byte order.
+void buffer_push_u8(buffer_t *buffer, uint8_t value);
+void buffer_push_u16(buffer_t *buffer, uint16_t value);
+void buffer_push_u32(buffer_t *buffer, uint32_t value);
+
+// Push a position given in host byte order, like `struct position` goes over the network.
+void buffer_push_pos(buffer_t *buffer, uint16_t x, uint16_t y);
+
 void buffer_clear(buffer_t *buffer);
 
-#endif // ROBOTS_BUFFER
\ No newline at end of file
+#endif // ROBOTS_BUFFER
@@ -3,120 +3,204 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "../msg.h"
 #include "err.h"
 
-#define N_BUCKETS 31
+#define BASE_SLOTS 16
 
-typedef struct Pair {
+// Open addressing with linear probing. A slot is empty if its value is NULL, which
+// can't be inserted. Removed entries leave a tombstone behind, so that they don't
+// break the probe sequences of other keys, and so that no entry ever moves while
+// iterating. Tombstones are dropped whenever the table gets rebuilt.
+typedef struct Slot {
     uint32_t key;
     void *value;
-    struct Pair *next;
-} Pair;
+} Slot;
 
 struct HashMap {
-    Pair *buckets[N_BUCKETS];
-    size_t size;
+    Slot *slots;
+    size_t capacity; // always a power of two
+    size_t size;     // live entries
+    size_t used;     // live entries and tombstones
+
+    // the previous table, if it had the same capacity, so that a map whose size holds
+    // steady while keys come and go can get rid of its tombstones without allocating
+    Slot *spare;
 };
 
-static unsigned int get_hash(uint32_t key);
+static char tombstone;
+#define TOMBSTONE ((void *) &tombstone)
+
+static size_t get_hash(hmap_t *map, uint32_t key);
+
+static bool is_live(Slot *slot) {
+    return slot->value != NULL && slot->value != TOMBSTONE;
+}
+
+static Slot *alloc_slots(size_t capacity) {
+    Slot *slots = calloc(capacity, sizeof *slots);
+    ENSURE(slots != NULL);
+    return slots;
+}
 
 hmap_t *hmap_new() {
     hmap_t *map = malloc(sizeof(hmap_t));
     if (!map)
         return NULL;
 
-    memset(map, 0, sizeof(hmap_t));
+    map->slots = alloc_slots(BASE_SLOTS);
+    map->capacity = BASE_SLOTS;
+    map->size = 0;
+    map->used = 0;
+    map->spare = NULL;
     return map;
 }
 
 void hmap_free(hmap_t *map, bool value_is_alloc) {
-    for (int h = 0; h < N_BUCKETS; ++h) {
-        for (Pair *p = map->buckets[h]; p;) {
-            Pair *q = p;
-            p = p->next;
-            if (value_is_alloc)
-                free(q->value);
-            free(q);
-        }
-    }
+    if (value_is_alloc)
+        hmap_clear(map, true);
+    free(map->slots);
+    free(map->spare);
     free(map);
 }
 
-static Pair *hmap_find(hmap_t *map, unsigned int h, uint32_t key) {
-    for (Pair *p = map->buckets[h]; p; p = p->next) {
-        if (key == p->key) {
-            return p;
+void hmap_clear(hmap_t *map, bool value_is_alloc) {
+    if (value_is_alloc) {
+        for (size_t i = 0; i < map->capacity; i++) {
+            if (is_live(&map->slots[i]))
+                free(map->slots[i].value);
         }
     }
+    memset(map->slots, 0, map->capacity * sizeof *map->slots);
+    map->size = 0;
+    map->used = 0;
+}
 
-    return NULL;
+// Return the slot holding `key`, or NULL if there's none.
+static Slot *hmap_find(hmap_t *map, uint32_t key) {
+    size_t mask = map->capacity - 1;
+
+    for (size_t i = get_hash(map, key);; i = (i + 1) & mask) {
+        Slot *slot = &map->slots[i];
+        if (slot->value == NULL)
+            return NULL;
+        if (slot->value != TOMBSTONE && slot->key == key)
+            return slot;
+    }
+}
+
+// Move all live entries into a table of `capacity` slots, leaving the tombstones behind.
+static void hmap_rebuild(hmap_t *map, size_t capacity) {
+    Slot *old_slots = map->slots;
+    size_t old_capacity = map->capacity;
+
+    if (map->spare && capacity == old_capacity) {
+        map->slots = memset(map->spare, 0, capacity * sizeof *map->slots);
+    } else {
+        free(map->spare);
+        map->slots = alloc_slots(capacity);
+    }
+    map->spare = NULL;
+    map->capacity = capacity;
+    map->used = map->size;
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (!is_live(&old_slots[i]))
+            continue;
+
+        size_t j = get_hash(map, old_slots[i].key);
+        while (map->slots[j].value != NULL)
+            j = (j + 1) & mask;
+        map->slots[j] = old_slots[i];
+    }
+
+    if (capacity == old_capacity)
+        map->spare = old_slots;
+    else
+        free(old_slots);
 }
 
 void *hmap_get(hmap_t *map, uint32_t key) {
-    uint32_t h = get_hash(key);
-    Pair *p = hmap_find(map, h, key);
-    return p ? p->value : NULL;
+    Slot *slot = hmap_find(map, key);
+    return slot ? slot->value : NULL;
 }
 
 bool hmap_insert(hmap_t *map, uint32_t key, void *value) {
     if (!value)
         return false;
 
-    uint32_t h = get_hash(key);
-    if (hmap_find(map, h, key))
-        return false;
+    // keep at least a quarter of the slots empty, so that probes stay short
+    if ((map->used + 1) * 4 > map->capacity * 3) {
+        size_t capacity = map->capacity;
+        while ((map->size + 1) * 2 > capacity)
+            capacity *= 2;
+        hmap_rebuild(map, capacity);
+    }
+
+    size_t mask = map->capacity - 1;
+    Slot *free_slot = NULL; // the first tombstone on the way, which can be reused
 
-    Pair *new_p = malloc(sizeof(Pair));
-    new_p->key = key;
-    new_p->value = value;
-    new_p->next = map->buckets[h];
-    map->buckets[h] = new_p;
+    for (size_t i = get_hash(map, key);; i = (i + 1) & mask) {
+        Slot *slot = &map->slots[i];
+
+        if (slot->value == NULL) {
+            if (!free_slot) {
+                free_slot = slot;
+                map->used++;
+            }
+            break;
+        }
+
+        if (slot->value == TOMBSTONE) {
+            if (!free_slot)
+                free_slot = slot;
+        } else if (slot->key == key) {
+            return false;
+        }
+    }
+
+    free_slot->key = key;
+    free_slot->value = value;
     map->size++;
 
     return true;
 }
 
 bool hmap_remove(hmap_t *map, uint32_t key, bool value_is_alloc) {
-    uint32_t h = get_hash(key);
-    Pair **pp = &(map->buckets[h]);
-
-    while (*pp) {
-        Pair *p = *pp;
-
-        if (key == p->key) {
-            *pp = p->next;
-            if (value_is_alloc)
-                free(p->value);
-            free(p);
-            map->size--;
-            return true;
-        }
+    Slot *slot = hmap_find(map, key);
+    if (!slot)
+        return false;
 
-        pp = &(p->next);
-    }
+    if (value_is_alloc)
+        free(slot->value);
+    slot->value = TOMBSTONE;
+    map->size--;
 
-    return false;
+    return true;
 }
 
 hmap_it_t hmap_iterator(hmap_t *map) {
-    hmap_it_t it = {0, map->buckets[0]};
+    (void) map;
+    hmap_it_t it = {0};
     return it;
 }
 
 bool hmap_next(hmap_t *map, hmap_it_t *it, uint32_t *key, void **value) {
-    Pair *p = it->pair;
-    while (!p && it->bucket < N_BUCKETS - 1) {
-        p = map->buckets[++it->bucket];
+    while (it->slot < map->capacity) {
+        Slot *slot = &map->slots[it->slot++];
+        if (is_live(slot)) {
+            *key = slot->key;
+            *value = slot->value;
+            return true;
+        }
     }
-    if (!p)
-        return false;
-    *key = p->key;
-    *value = p->value;
-    it->pair = p->next;
-    return true;
+
+    return false;
 }
 
-static unsigned int get_hash(uint32_t key) {
-    return (key * 5) % N_BUCKETS;
+static size_t get_hash(hmap_t *map, uint32_t key) {
+    // keys tend to be consecutive, so spread them over the whole table
+    uint32_t h = key * 0x9E3779B1u;
+    h ^= h >> 16;
+    return h & (map->capacity - 1);
 }
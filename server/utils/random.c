@@ -1,17 +1,119 @@
 #include "random.h"
 
-static uint32_t previous;
+#define LCG_MODULUS 2147483647u // 2^31 - 1
+#define LCG_MULTIPLIER 48271u
+#define LCG_JUMP_LOG 24
 
-void random_start(uint32_t seed) {
-    previous = seed;
+// `x mod (2^31 - 1)` for any `x` below 2^62, without a division: as 2^31 = 1 (mod 2^31 - 1),
+// the bits above the 31st can be folded back onto the lower ones
+static uint32_t lcg_reduce(uint64_t x) {
+    x = (x & LCG_MODULUS) + (x >> 31);
+    x = (x & LCG_MODULUS) + (x >> 31);
+    return (uint32_t) (x >= LCG_MODULUS ? x - LCG_MODULUS : x);
 }
 
-uint32_t random_next() {
-    uint32_t result = (uint32_t) (((uint64_t) previous * 48271) % 2147483647);
-    previous = result;
+static uint32_t lcg_next(random_t *rng) {
+    rng->s[0] = lcg_reduce((uint64_t) rng->s[0] * LCG_MULTIPLIER);
+    return rng->s[0];
+}
+
+static uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+static uint32_t xoshiro_next(random_t *rng) {
+    uint32_t *s = rng->s;
+    uint32_t result = rotl(s[1] * 5, 7) * 9;
+    uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+
     return result;
 }
 
-uint16_t random_pos_next(uint16_t size) {
-    return (uint16_t) (random_next() % size);
+static uint64_t splitmix64_next(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+void random_start(random_t *rng, enum random_kind kind, uint32_t seed) {
+    rng->kind = kind;
+
+    if (kind == RANDOM_LCG) {
+        rng->s[0] = seed;
+        rng->s[1] = rng->s[2] = rng->s[3] = 0;
+        return;
+    }
+
+    // splitmix64 never gives two zeros in a row, which is the one state xoshiro can't leave
+    uint64_t x = seed;
+    for (int i = 0; i < 4; i += 2) {
+        uint64_t z = splitmix64_next(&x);
+        rng->s[i] = (uint32_t) z;
+        rng->s[i + 1] = (uint32_t) (z >> 32);
+    }
+}
+
+uint32_t random_next(random_t *rng) {
+    return rng->kind == RANDOM_LCG ? lcg_next(rng) : xoshiro_next(rng);
+}
+
+uint16_t random_pos_next(random_t *rng, uint16_t size) {
+    if (rng->kind == RANDOM_LCG)
+        return (uint16_t) (lcg_next(rng) % size);
+
+    // the high bits scaled to `size`, rather than a division
+    return (uint16_t) (((uint64_t) xoshiro_next(rng) * size) >> 32);
+}
+
+void random_pos_fill(random_t *rng, uint16_t *coords, size_t n, uint16_t size_x, uint16_t size_y) {
+    if (rng->kind == RANDOM_LCG) {
+        for (size_t i = 0; i < n; i++) {
+            coords[2 * i] = (uint16_t) (lcg_next(rng) % size_x);
+            coords[2 * i + 1] = (uint16_t) (lcg_next(rng) % size_y);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            coords[2 * i] = (uint16_t) (((uint64_t) xoshiro_next(rng) * size_x) >> 32);
+            coords[2 * i + 1] = (uint16_t) (((uint64_t) xoshiro_next(rng) * size_y) >> 32);
+        }
+    }
+}
+
+void random_jump(random_t *rng) {
+    if (rng->kind == RANDOM_LCG) {
+        // n steps multiply the state by 48271^n
+        uint32_t multiplier = LCG_MULTIPLIER;
+        for (int i = 0; i < LCG_JUMP_LOG; i++)
+            multiplier = lcg_reduce((uint64_t) multiplier * multiplier);
+
+        rng->s[0] = lcg_reduce((uint64_t) rng->s[0] * multiplier);
+        return;
+    }
+
+    // the jump polynomial published along with xoshiro128**, for 2^64 steps
+    static const uint32_t jump[] = {0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b};
+
+    uint32_t s[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        for (int b = 0; b < 32; b++) {
+            if (jump[i] & (UINT32_C(1) << b)) {
+                s[0] ^= rng->s[0];
+                s[1] ^= rng->s[1];
+                s[2] ^= rng->s[2];
+                s[3] ^= rng->s[3];
+            }
+            xoshiro_next(rng);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = s[i];
 }
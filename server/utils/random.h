@@ -2,11 +2,39 @@
 #define ROBOTS_RANDOM
 
 #include <stdint.h>
+#include <stddef.h>
 
-void random_start(uint32_t seed);
+enum random_kind {
+    // the original Lehmer generator, x = x * 48271 mod (2^31 - 1), seeded with the seed as is;
+    // the same seed gives the same games as it always did
+    RANDOM_LCG,
 
-uint32_t random_next();
+    // xoshiro128**, seeded through splitmix64: faster, and with a period long enough
+    // to be split into streams which never overlap
+    RANDOM_XOSHIRO,
+};
 
-uint16_t random_pos_next(uint16_t size);
+// State of a random number generator. Every game owns one, so that games running
+// at the same time don't interfere with each other's sequences.
+typedef struct random {
+    enum random_kind kind;
+    uint32_t s[4]; // only `s[0]` for `RANDOM_LCG`
+} random_t;
+
+void random_start(random_t *rng, enum random_kind kind, uint32_t seed);
+
+uint32_t random_next(random_t *rng);
+
+uint16_t random_pos_next(random_t *rng, uint16_t size);
+
+// Fill `coords` with `n` positions on a `size_x` by `size_y` board, x before y,
+// exactly as `n` pairs of calls to `random_pos_next()` would.
+void random_pos_fill(random_t *rng, uint16_t *coords, size_t n, uint16_t size_x, uint16_t size_y);
+
+// Skip as many numbers as a single stream may draw: 2^64 for `RANDOM_XOSHIRO`,
+// and 2^24 for `RANDOM_LCG`, whose whole period only fits 127 such streams.
+// Generators started with the same seed and jumped a different number of times
+// give sequences which don't overlap.
+void random_jump(random_t *rng);
 
 #endif //ROBOTS_RANDOM
@@ -0,0 +1,52 @@
+#include "spsc.h"
+
+#include <string.h>
+
+#include "err.h"
+
+spsc_t *spsc_new(size_t item_size, size_t capacity) {
+    size_t real_capacity = 1;
+    while (real_capacity < capacity)
+        real_capacity *= 2;
+
+    spsc_t *queue = aligned_alloc(_Alignof(spsc_t), sizeof *queue);
+    ENSURE(queue != NULL);
+
+    queue->items = malloc(real_capacity * item_size);
+    ENSURE(queue->items != NULL);
+    queue->item_size = item_size;
+    queue->mask = real_capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+
+    return queue;
+}
+
+void spsc_free(spsc_t *queue) {
+    free(queue->items);
+    free(queue);
+}
+
+bool spsc_push(spsc_t *queue, const void *item) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) > queue->mask)
+        return false;
+
+    memcpy(queue->items + (tail & queue->mask) * queue->item_size, item, queue->item_size);
+
+    // publish the item only once it's fully written
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_pop(spsc_t *queue, void *item) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&queue->tail, memory_order_acquire))
+        return false;
+
+    memcpy(item, queue->items + (head & queue->mask) * queue->item_size, queue->item_size);
+
+    // the slot can be reused only once it's fully read
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef ROBOTS_SPSC
+#define ROBOTS_SPSC
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define CACHE_LINE 64
+
+// A bounded queue of fixed-size items passed from one thread to one other thread,
+// without any locks. Items are copied in and out.
+typedef struct spsc {
+    char *items;
+    size_t item_size;
+    size_t mask; // the capacity is a power of 2
+
+    // each index is only written by one side, and they're kept apart
+    // so that the two threads don't keep taking the cache line from each other
+    _Alignas(CACHE_LINE) _Atomic size_t head; // the next item to pop, written by the consumer
+    _Alignas(CACHE_LINE) _Atomic size_t tail; // the next free slot, written by the producer
+} spsc_t;
+
+// Create a queue for at least `capacity` items of `item_size` bytes each.
+spsc_t *spsc_new(size_t item_size, size_t capacity);
+
+void spsc_free(spsc_t *queue);
+
+// Copy the item into the queue, unless it's full. Only ever called by the producer.
+bool spsc_push(spsc_t *queue, const void *item);
+
+// Copy the oldest item out of the queue, unless it's empty. Only ever called by the consumer.
+bool spsc_pop(spsc_t *queue, void *item);
+
+#endif // ROBOTS_SPSC
@@ -0,0 +1,151 @@
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "err.h"
+
+// A loop handed to the pool, living on the stack of the thread which handed it.
+struct job {
+    void (*fn)(void *ctx, size_t begin, size_t end);
+    void *ctx;
+    size_t n;
+    size_t chunk;
+    size_t n_chunks;
+    size_t claimed;  // chunks taken by some thread
+    size_t finished; // chunks done with
+    pthread_cond_t done; // signalled once all chunks are finished
+    struct job *next;
+};
+
+struct thread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // signalled when a job comes in, or when the pool stops
+    struct job *jobs;    // jobs with chunks left to claim, oldest first
+    bool stopping;
+    uint16_t n_threads;
+    pthread_t *threads;
+};
+
+// Take the next chunk of `job`, dropping the job off the queue if it was the last one.
+// Called with the pool's lock held.
+static size_t claim_chunk(thread_pool_t *pool, struct job *job) {
+    size_t begin = job->claimed++ * job->chunk;
+
+    if (job->claimed == job->n_chunks) {
+        struct job **link = &pool->jobs;
+        while (*link != job)
+            link = &(*link)->next;
+        *link = job->next;
+    }
+
+    return begin;
+}
+
+// Run a claimed chunk, with the pool's lock released in the meantime.
+static void run_chunk(thread_pool_t *pool, struct job *job, size_t begin) {
+    size_t end = begin + job->chunk < job->n ? begin + job->chunk : job->n;
+
+    CHECK(pthread_mutex_unlock(&pool->lock));
+    job->fn(job->ctx, begin, end);
+    CHECK(pthread_mutex_lock(&pool->lock));
+
+    if (++job->finished == job->n_chunks)
+        CHECK(pthread_cond_signal(&job->done));
+}
+
+static void *helper_loop(void *arg) {
+    thread_pool_t *pool = arg;
+
+    CHECK(pthread_mutex_lock(&pool->lock));
+    while (true) {
+        while (!pool->stopping && pool->jobs == NULL)
+            CHECK(pthread_cond_wait(&pool->work, &pool->lock));
+
+        if (pool->stopping)
+            break;
+
+        struct job *job = pool->jobs;
+        run_chunk(pool, job, claim_chunk(pool, job));
+    }
+    CHECK(pthread_mutex_unlock(&pool->lock));
+
+    return NULL;
+}
+
+thread_pool_t *thread_pool_new(uint16_t n_threads) {
+    thread_pool_t *pool = malloc(sizeof *pool);
+    ENSURE(pool != NULL);
+
+    CHECK(pthread_mutex_init(&pool->lock, NULL));
+    CHECK(pthread_cond_init(&pool->work, NULL));
+    pool->jobs = NULL;
+    pool->stopping = false;
+    pool->n_threads = n_threads;
+
+    pool->threads = malloc(n_threads * sizeof *pool->threads);
+    ENSURE(pool->threads != NULL || n_threads == 0);
+    for (uint16_t i = 0; i < n_threads; i++)
+        CHECK(pthread_create(&pool->threads[i], NULL, helper_loop, pool));
+
+    return pool;
+}
+
+void thread_pool_free(thread_pool_t *pool) {
+    CHECK(pthread_mutex_lock(&pool->lock));
+    pool->stopping = true;
+    CHECK(pthread_cond_broadcast(&pool->work));
+    CHECK(pthread_mutex_unlock(&pool->lock));
+
+    for (uint16_t i = 0; i < pool->n_threads; i++)
+        CHECK(pthread_join(pool->threads[i], NULL));
+
+    CHECK(pthread_cond_destroy(&pool->work));
+    CHECK(pthread_mutex_destroy(&pool->lock));
+    free(pool->threads);
+    free(pool);
+}
+
+void thread_pool_run(thread_pool_t *pool, size_t n, size_t chunk,
+                     void (*fn)(void *ctx, size_t begin, size_t end), void *ctx) {
+    if (n == 0)
+        return;
+
+    size_t n_chunks = (n + chunk - 1) / chunk;
+    if (pool->n_threads == 0 || n_chunks == 1) { // nobody to share the work with
+        fn(ctx, 0, n);
+        return;
+    }
+
+    struct job job = {
+        .fn = fn,
+        .ctx = ctx,
+        .n = n,
+        .chunk = chunk,
+        .n_chunks = n_chunks,
+        .claimed = 0,
+        .finished = 0,
+        .next = NULL
+    };
+    CHECK(pthread_cond_init(&job.done, NULL));
+
+    CHECK(pthread_mutex_lock(&pool->lock));
+
+    struct job **link = &pool->jobs;
+    while (*link)
+        link = &(*link)->next;
+    *link = &job;
+    CHECK(pthread_cond_broadcast(&pool->work));
+
+    // rather than just waiting, work on the job too
+    while (job.claimed < job.n_chunks)
+        run_chunk(pool, &job, claim_chunk(pool, &job));
+
+    while (job.finished < job.n_chunks)
+        CHECK(pthread_cond_wait(&job.done, &pool->lock));
+
+    CHECK(pthread_mutex_unlock(&pool->lock));
+    CHECK(pthread_cond_destroy(&job.done));
+}
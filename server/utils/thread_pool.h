@@ -0,0 +1,23 @@
+#ifndef ROBOTS_THREAD_POOL
+#define ROBOTS_THREAD_POOL
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A fixed set of threads which help out with loops whose iterations don't depend
+// on each other. Any number of threads can hand loops to the same pool at once.
+typedef struct thread_pool thread_pool_t;
+
+// Start a pool of `n_threads` helper threads.
+thread_pool_t *thread_pool_new(uint16_t n_threads);
+
+// Stop the pool's threads. No loop may be running on it anymore.
+void thread_pool_free(thread_pool_t *pool);
+
+// Call `fn(ctx, begin, end)` for consecutive ranges of up to `chunk` indices, together
+// covering [0, n), spread over the pool's threads and the calling one. Return once
+// all of the calls returned. The ranges are handled in no particular order.
+void thread_pool_run(thread_pool_t *pool, size_t n, size_t chunk,
+                     void (*fn)(void *ctx, size_t begin, size_t end), void *ctx);
+
+#endif // ROBOTS_THREAD_POOL
@@ -0,0 +1,492 @@
+#include "worker.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+
+#include "utils/buffer.h"
+#include "utils/err.h"
+
+#define MAX_EVENTS 64
+
+#ifdef ROBOTS_IO_URING
+#define URING_ENTRIES 1024
+#define RECV_BUFS     512  // must be a power of 2
+#define RECV_BUF_SIZE 4096
+#define RECV_GROUP    0
+#endif
+
+struct worker *worker_new(struct room **rooms, int n_rooms, bool use_uring) {
+    struct worker *worker = malloc(sizeof *worker);
+    ENSURE(worker != NULL);
+
+    worker->rooms = rooms;
+    worker->n_rooms = n_rooms;
+    CHECK_ERRNO(pipe(worker->wake_fds));
+
+    // handoffs get read until none is left, so reading mustn't block
+    int flags = fcntl(worker->wake_fds[0], F_GETFL);
+    ENSURE(flags != -1);
+    CHECK(fcntl(worker->wake_fds[0], F_SETFL, flags | O_NONBLOCK));
+
+    // every room has at most one tick on its way
+    worker->ticks_due = spsc_new(sizeof(struct tick), (size_t) n_rooms);
+    worker->ticks_played = spsc_new(sizeof(struct tick), (size_t) n_rooms);
+    worker->sim_wake_fd = eventfd(0, EFD_CLOEXEC);
+    CHECK_ERRNO(worker->sim_wake_fd);
+    worker->played_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    CHECK_ERRNO(worker->played_fd);
+
+    worker->uses_uring = use_uring;
+#ifdef ROBOTS_IO_URING
+    if (use_uring) {
+        worker->epoll_fd = -1;
+        worker->timer_fd = -1;
+        ENSURE(uring_init(&worker->ring, URING_ENTRIES));
+        ENSURE(uring_bufs_init(&worker->ring, &worker->bufs, RECV_GROUP, RECV_BUFS, RECV_BUF_SIZE));
+        return worker;
+    }
+#else
+    ENSURE(!use_uring);
+#endif
+
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    CHECK_ERRNO(worker->epoll_fd);
+
+    // the wake-up pipe is watched without a connection attached
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    CHECK_ERRNO(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fds[0], &event));
+
+    // and so are the timer and the played turns, told apart by their addresses
+    worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    CHECK_ERRNO(worker->timer_fd);
+    worker->timer_deadline_us = UINT64_MAX;
+    event.data.ptr = &worker->timer_fd;
+    CHECK_ERRNO(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd, &event));
+
+    event.data.ptr = &worker->played_fd;
+    CHECK_ERRNO(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->played_fd, &event));
+
+    return worker;
+}
+
+void worker_hand_off(struct worker *worker, struct handoff *handoff) {
+    // writes of at most `PIPE_BUF` bytes are atomic, so no locking is needed
+    ssize_t written = write(worker->wake_fds[1], handoff, sizeof *handoff);
+    ENSURE(written == sizeof *handoff);
+}
+
+static void notify(int event_fd) {
+    uint64_t one = 1;
+    ssize_t written = write(event_fd, &one, sizeof one);
+    ENSURE(written == sizeof one);
+}
+
+// Send the turns which are over to the simulation thread.
+static void dispatch_ticks(struct worker *worker) {
+    struct tick tick;
+    bool dispatched = false;
+
+    for (int r = 0; r < worker->n_rooms; r++) {
+        if (room_tick(worker->rooms[r], &tick)) {
+            ENSURE(spsc_push(worker->ticks_due, &tick));
+            dispatched = true;
+        }
+    }
+
+    if (dispatched)
+        notify(worker->sim_wake_fd);
+}
+
+// Send out the turns the simulation thread played.
+static void finish_ticks(struct worker *worker) {
+    // reset the counter before looking, so that a tick coming right after gets noticed
+    uint64_t n_played;
+    ssize_t read_len = read(worker->played_fd, &n_played, sizeof n_played);
+    (void) read_len;
+
+    struct tick tick;
+    while (spsc_pop(worker->ticks_played, &tick))
+        room_finish_tick(&tick);
+}
+
+static void *simulation_loop(void *arg) {
+    struct worker *worker = arg;
+    struct tick tick;
+
+    while (true) {
+        // sleep until a tick comes; one which came after the last look has already woken this up
+        uint64_t n_due;
+        if (read(worker->sim_wake_fd, &n_due, sizeof n_due) == -1)
+            continue; // interrupted by a signal
+
+        while (spsc_pop(worker->ticks_due, &tick)) {
+            room_simulate(&tick);
+            ENSURE(spsc_push(worker->ticks_played, &tick));
+            notify(worker->played_fd);
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef ROBOTS_IO_URING
+
+// What a request is for. It's kept in the low bits of the request's `user_data`,
+// next to the connection it concerns, if any.
+enum request_kind {
+    REQ_WAKE,     // readability of the wake-up pipe
+    REQ_PLAYED,   // readability of `played_fd`
+    REQ_RECV,     // input from the client
+    REQ_WRITE,    // a write of the client's queued output
+    REQ_POLL_OUT, // writability of the client's socket
+    REQ_CANCEL    // cancellation of the requests of a closed connection
+};
+
+#define KIND_MASK ((uint64_t) 7)
+
+static uint64_t request_data(struct connection *conn, enum request_kind kind) {
+    return (uint64_t) (uintptr_t) conn | kind;
+}
+
+// Watch an fd of the worker itself for readability, for as long as it runs.
+static void submit_watch(struct worker *worker, int fd, enum request_kind kind) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = request_data(NULL, kind);
+}
+
+// Receive everything the client sends from now on, into buffers the kernel picks itself.
+static void submit_recv(struct worker *worker, struct connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->sock.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = worker->bufs.group;
+    sqe->user_data = request_data(conn, REQ_RECV);
+    conn->in_flight++;
+}
+
+static void submit_write(struct worker *worker, struct connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->sock.fd;
+    sqe->addr = (uint64_t) (uintptr_t) sock_start_write(&conn->sock);
+    sqe->len = 1;
+    // with `MSG_DONTWAIT`, the write doesn't wait for room in the kernel, but it still
+    // reads the queued frames whenever it's done: at the next submission at the earliest,
+    // and possibly later. Until it completes, the room mustn't reuse the turn buffers
+    // the frames may borrow
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = request_data(conn, REQ_WRITE);
+    conn->in_flight++;
+    conn->room->writes_in_flight++;
+    conn->polls_out = true;
+}
+
+static void submit_poll_out(struct worker *worker, struct connection *conn) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->sock.fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = request_data(conn, REQ_POLL_OUT);
+    conn->in_flight++;
+}
+
+// Make the requests which could wait forever on a closed connection complete right away.
+static void cancel_requests(struct worker *worker, struct connection *conn) {
+    enum request_kind kinds[] = {REQ_RECV, REQ_POLL_OUT};
+
+    for (size_t i = 0; i < sizeof kinds / sizeof *kinds; i++) {
+        struct io_uring_sqe *sqe = uring_get_sqe(&worker->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = request_data(conn, kinds[i]);
+        sqe->user_data = request_data(NULL, REQ_CANCEL);
+    }
+
+    conn->cancelled = true;
+}
+
+#endif // ROBOTS_IO_URING
+
+static void receive_handoffs(struct worker *worker) {
+    struct handoff handoff;
+    ssize_t read_len;
+
+    while ((read_len = read(worker->wake_fds[0], &handoff, sizeof handoff)) > 0) {
+        ENSURE(read_len == sizeof handoff);
+
+        struct connection *conn = room_add_client(handoff.room, handoff.fd, handoff.address, handoff.port);
+
+#ifdef ROBOTS_IO_URING
+        if (worker->uses_uring) {
+            conn->sock.deferred = true;
+            submit_recv(worker, conn);
+            continue;
+        }
+#endif
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+        CHECK_ERRNO(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, conn->sock.fd, &event));
+    }
+}
+
+// Start or stop waiting for the client's socket to take its queued output.
+static void watch_output(struct worker *worker, struct connection *conn, bool polls_out) {
+#ifdef ROBOTS_IO_URING
+    // the flag only gets cleared once a write empties the queue
+    if (worker->uses_uring) {
+        submit_write(worker, conn);
+        return;
+    }
+#endif
+
+    struct epoll_event event = {.events = EPOLLIN | (polls_out ? EPOLLOUT : 0), .data.ptr = conn};
+    CHECK_ERRNO(epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->sock.fd, &event));
+    conn->polls_out = polls_out;
+}
+
+// Go through the connections the rooms marked as needing attention. Closed ones are
+// freed, and the rest are watched for writability for as long as they have output queued.
+// This is the only place where connections are freed, so all events of a batch stay valid.
+static void handle_dirty(struct worker *worker) {
+    for (int r = 0; r < worker->n_rooms; r++) {
+        struct room *room = worker->rooms[r];
+        struct connection **dirty = (struct connection **) room->dirty->buf;
+        size_t n_dirty = room->dirty->size / sizeof *dirty;
+
+        for (size_t i = 0; i < n_dirty; i++) {
+            struct connection *conn = dirty[i];
+            conn->dirty = false;
+
+            if (conn->sock.fd == -1) {
+                // requests still in flight will mark the connection again once they're done
+                if (conn->in_flight == 0) {
+                    room_remove_client(room, conn); // closing the fd also removed it from epoll
+                    free(conn);
+                }
+#ifdef ROBOTS_IO_URING
+                else if (!conn->cancelled) {
+                    cancel_requests(worker, conn);
+                }
+#endif
+                continue;
+            }
+
+            bool polls_out = sock_pending(&conn->sock) > 0;
+            if (polls_out != conn->polls_out)
+                watch_output(worker, conn, polls_out);
+        }
+
+        buffer_clear(room->dirty);
+    }
+}
+
+// Return when the first of the worker's rooms has its turn end, or `UINT64_MAX` if none is playing.
+static uint64_t next_deadline(struct worker *worker) {
+    uint64_t deadline = UINT64_MAX;
+
+    for (int r = 0; r < worker->n_rooms; r++) {
+        uint64_t room_deadline_us = room_deadline(worker->rooms[r]);
+        if (room_deadline_us < deadline)
+            deadline = room_deadline_us;
+    }
+
+    return deadline;
+}
+
+// Set the timer to expire at the absolute time `deadline_us`, or turn it off for `UINT64_MAX`.
+static void set_timer(struct worker *worker, uint64_t deadline_us) {
+    if (deadline_us == worker->timer_deadline_us)
+        return;
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof spec);
+    if (deadline_us != UINT64_MAX) {
+        spec.it_value.tv_sec = (time_t) (deadline_us / 1000000);
+        spec.it_value.tv_nsec = (long) (deadline_us % 1000000) * 1000;
+    }
+
+    CHECK_ERRNO(timerfd_settime(worker->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL));
+    worker->timer_deadline_us = deadline_us;
+}
+
+static void *worker_loop(void *arg) {
+    struct worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        // turns end on the timer, which keeps to microseconds, unlike epoll's own timeout
+        set_timer(worker, next_deadline(worker));
+        int n_events = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        if (n_events == -1)
+            n_events = 0; // interrupted by a signal
+
+        // check if any turns have ended
+        dispatch_ticks(worker);
+
+        for (int i = 0; i < n_events; i++) {
+            struct connection *conn = events[i].data.ptr;
+
+            if (conn == NULL) { // new connection
+                receive_handoffs(worker);
+                continue;
+            }
+
+            if (events[i].data.ptr == &worker->timer_fd) { // a turn ended, as handled above
+                uint64_t expirations;
+                ssize_t read_len = read(worker->timer_fd, &expirations, sizeof expirations);
+                (void) read_len; // nothing to read means the timer was already set to a later time
+                continue;
+            }
+
+            if (events[i].data.ptr == &worker->played_fd) {
+                finish_ticks(worker);
+                continue;
+            }
+
+            // skip clients which were dropped earlier in this batch
+            if (conn->sock.fd == -1)
+                continue;
+
+            if (events[i].events & EPOLLOUT) // there's room for queued output
+                sock_flush(&conn->sock);
+
+            if (conn->sock.fd != -1) {
+                if (events[i].events & EPOLLIN) // a client sent something
+                    room_handle_input(conn->room, conn);
+                else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    disconnect_client(&conn->sock);
+            }
+
+            room_check_client(conn->room, conn);
+        }
+
+        handle_dirty(worker);
+    }
+
+    return NULL;
+}
+
+#ifdef ROBOTS_IO_URING
+
+static void handle_completion(struct worker *worker, struct io_uring_cqe *cqe) {
+    enum request_kind kind = (enum request_kind) (cqe->user_data & KIND_MASK);
+    struct connection *conn = (struct connection *) (uintptr_t) (cqe->user_data & ~KIND_MASK);
+    bool more = cqe->flags & IORING_CQE_F_MORE; // a multishot request which goes on
+
+    if (kind == REQ_CANCEL)
+        return;
+
+    if (kind == REQ_WAKE) { // new connections
+        receive_handoffs(worker);
+        if (!more)
+            submit_watch(worker, worker->wake_fds[0], REQ_WAKE);
+        return;
+    }
+
+    if (kind == REQ_PLAYED) {
+        finish_ticks(worker);
+        if (!more)
+            submit_watch(worker, worker->played_fd, REQ_PLAYED);
+        return;
+    }
+
+    if (!more)
+        conn->in_flight--;
+
+    switch (kind) {
+        case REQ_RECV:
+            if (cqe->res > 0 && conn->sock.fd != -1)
+                room_handle_data(conn->room, conn, uring_buf(&worker->bufs, cqe), (size_t) cqe->res);
+            else if (cqe->res <= 0 && cqe->res != -ENOBUFS && conn->sock.fd != -1)
+                disconnect_client(&conn->sock); // the client hung up, or the connection broke
+
+            if (cqe->flags & IORING_CQE_F_BUFFER)
+                uring_buf_recycle(&worker->bufs, cqe);
+
+            // the request also ends if the kernel ran out of buffers
+            if (!more && conn->sock.fd != -1)
+                submit_recv(worker, conn);
+            break;
+
+        case REQ_WRITE:
+            sock_end_write(&conn->sock, cqe->res);
+            room_write_done(conn->room); // the queued frames are free to change from now on
+
+            if (conn->sock.fd == -1)
+                break;
+            if (sock_pending(&conn->sock) == 0)
+                conn->polls_out = false;
+            else if (cqe->res == -EAGAIN)
+                submit_poll_out(worker, conn);
+            else
+                submit_write(worker, conn);
+            break;
+
+        case REQ_POLL_OUT:
+            // on an error, the write will find out what's wrong
+            if (conn->sock.fd != -1)
+                submit_write(worker, conn);
+            break;
+
+        default:
+            break;
+    }
+
+    room_check_client(conn->room, conn);
+}
+
+static void *worker_loop_uring(void *arg) {
+    struct worker *worker = arg;
+    submit_watch(worker, worker->wake_fds[0], REQ_WAKE);
+    submit_watch(worker, worker->played_fd, REQ_PLAYED);
+
+    while (true) {
+        // this also submits everything queued up during the previous round,
+        // which includes the writes of a whole broadcast, in a single system call
+        uint64_t deadline = next_deadline(worker);
+        uint64_t now = monotonic_us();
+        int64_t timeout_us = deadline == UINT64_MAX ? -1 : deadline > now ? (int64_t) (deadline - now) : 0;
+        uring_wait(&worker->ring, timeout_us);
+
+        // check if any turns have ended
+        dispatch_ticks(worker);
+
+        // like with epoll, the rest waits for the next round, so that turns keep ending on time
+        // however much input there is; a client sending too much then runs out of buffers
+        struct io_uring_cqe *cqe;
+        for (int i = 0; i < MAX_EVENTS && (cqe = uring_peek(&worker->ring)) != NULL; i++) {
+            handle_completion(worker, cqe);
+            uring_seen(&worker->ring);
+        }
+
+        handle_dirty(worker);
+    }
+
+    return NULL;
+}
+
+#endif // ROBOTS_IO_URING
+
+void worker_start(struct worker *worker) {
+    void *(*loop)(void *) = worker_loop;
+#ifdef ROBOTS_IO_URING
+    if (worker->uses_uring)
+        loop = worker_loop_uring;
+#endif
+
+    CHECK(pthread_create(&worker->thread, NULL, loop, worker));
+    CHECK(pthread_create(&worker->sim_thread, NULL, simulation_loop, worker));
+}
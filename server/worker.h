@@ -0,0 +1,55 @@
+#ifndef ROBOTS_WORKER
+#define ROBOTS_WORKER
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils/spsc.h"
+#include "room.h"
+#ifdef ROBOTS_IO_URING
+#include "uring.h"
+#endif
+
+// A thread running the event loop of a fixed set of rooms, together with a thread
+// which plays out their turns, so that the clients' I/O goes on in the meantime.
+struct worker {
+    pthread_t thread;
+    int wake_fds[2]; // pipe through which new connections are handed to the worker
+    int epoll_fd;    // watches the wake-up pipe, the timer and all clients of the worker's rooms
+    int timer_fd;    // expires when the earliest turn of the worker's rooms ends
+    uint64_t timer_deadline_us; // what `timer_fd` is set to, `UINT64_MAX` if it's off
+
+    bool uses_uring; // if set, all of the above goes through `ring` instead
+#ifdef ROBOTS_IO_URING
+    struct uring ring;
+    struct uring_bufs bufs; // where input from the clients is received into
+#endif
+
+    struct room **rooms;
+    int n_rooms;
+
+    pthread_t sim_thread;
+    spsc_t *ticks_due;    // `struct tick`s to be played out, from the worker to the simulation thread
+    spsc_t *ticks_played; // the same, on their way back
+    int sim_wake_fd;      // eventfd signalled whenever `ticks_due` gets a tick
+    int played_fd;        // eventfd signalled whenever `ticks_played` gets a tick
+};
+
+// A connection accepted by the main thread, on its way to a room.
+struct handoff {
+    struct room *room;
+    int fd;
+    char *address;
+    uint16_t port;
+};
+
+// Create a worker, running its loop on io_uring if `use_uring` is set, or on epoll otherwise.
+struct worker *worker_new(struct room **rooms, int n_rooms, bool use_uring);
+
+void worker_start(struct worker *worker);
+
+// Pass a connection to the worker which owns `handoff->room`. Safe to call from any thread.
+void worker_hand_off(struct worker *worker, struct handoff *handoff);
+
+#endif // ROBOTS_WORKER